@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <fstream>
+#include <algorithm>
+
+#include "memory.h"
+#include "analyser.h"
+
+
+// Cycle of the line each ROM address ran on, learnt from good lines
+#define OFFSET_UNKNOWN   0xFF
+#define OFFSET_VARIABLE  0xFE
+
+
+namespace Analyser
+{
+    struct Trace
+    {
+        uint16_t _address;
+        uint8_t _IR;
+        int _offset;
+    };
+
+    typedef std::map<int, uint64_t> Histogram;
+
+
+    bool _analysing = false;
+
+    uint64_t _frames = 0;
+    uint64_t _lines = 0;
+    uint64_t _linesInError = 0;
+
+    // Unknown until the first rising hSync edge and the first falling vSync edge respectively
+    int64_t _lineStart = -1;
+    int _lineNumber = -1;
+    uint16_t _fetchPC = 0x0000;
+
+    Line _line;
+    Line _frameLines[ANALYSER_LINES];
+    int _frameLength = 0;
+    std::vector<Line> _lastFrame;
+
+    Trace _trace[ANALYSER_TRACE];
+    int _traceLength = 0;
+    uint8_t _offsets[ROM_SIZE];
+    uint8_t _confidence[ROM_SIZE];
+
+    Histogram _lineLengths;
+    Histogram _hSyncPulses;
+    Histogram _pixelCounts;
+    Histogram _linesPerFrame;
+    Histogram _vSyncPulses;
+    uint32_t _lineHistograms[ANALYSER_LINES][ANALYSER_BUCKETS];
+
+    std::vector<Offender> _offenders;
+
+
+    bool getAnalysing(void) {return _analysing;}
+    uint64_t getFramesAnalysed(void) {return _frames;}
+    uint64_t getLinesAnalysed(void) {return _lines;}
+    uint64_t getLinesInError(void) {return _linesInError;}
+
+
+    void start(void)
+    {
+        _frames = 0;
+        _lines = 0;
+        _linesInError = 0;
+        _lastFrame.clear();
+        resync();
+
+        memset(_offsets, OFFSET_UNKNOWN, sizeof(_offsets));
+        memset(_confidence, 0, sizeof(_confidence));
+        memset(_lineHistograms, 0, sizeof(_lineHistograms));
+        _lineLengths.clear();
+        _hSyncPulses.clear();
+        _pixelCounts.clear();
+        _linesPerFrame.clear();
+        _vSyncPulses.clear();
+        _offenders.clear();
+
+        _analysing = true;
+    }
+
+    void stop(const std::string& filename)
+    {
+        if(!_analysing) return;
+
+        _analysing = false;
+        if(_lines == 0)
+        {
+            fprintf(stderr, "Analyser::stop() : no complete lines were analysed\n");
+            return;
+        }
+
+        if(writeReport(filename))
+        {
+            fprintf(stderr, "Analyser::stop() : %" PRIu64 " frames, %" PRIu64 " lines, %" PRIu64 " in error : report written to '%s'\n", _frames, _lines, _linesInError, filename.c_str());
+        }
+    }
+
+
+    void resync(void)
+    {
+        _lineStart = -1;
+        _lineNumber = -1;
+        _frameLength = 0;
+        _traceLength = 0;
+        _line = Line();
+    }
+
+    // Far jumps and the vCPU's dispatch, whatever they land on two cycles later, (after the delay slot), is code being entered
+    bool isEntry(const Trace& trace) {return ((trace._IR >> 5) == 7  &&  (trace._IR & 0x1C) == 0x00)  ||  trace._address == ROM_VCPU_DISPATCH;}
+
+    // Every ROM address that ran on a good line is either always on the same cycle of it, or variable
+    void learnLine(void)
+    {
+        for(int i=0; i<_traceLength; i++)
+        {
+            uint16_t address = _trace[i]._address;
+            uint8_t& offset = _offsets[address];
+            if(offset == OFFSET_UNKNOWN)
+            {
+                offset = uint8_t(_trace[i]._offset);
+            }
+            else if(offset != _trace[i]._offset)
+            {
+                offset = OFFSET_VARIABLE;
+            }
+            if(offset != OFFSET_VARIABLE  &&  _confidence[address] < 0xFF) _confidence[address]++;
+        }
+    }
+
+    Offender findOffender(void)
+    {
+        Offender offender;
+        offender._frame = _frames;
+        offender._line = _lineNumber;
+        offender._length = _line._length;
+        offender._pixels = _line._pixels;
+
+        int onTime = -1;
+        for(int i=0; i<_traceLength; i++)
+        {
+            uint8_t offset = _offsets[_trace[i]._address];
+            if(offset >= OFFSET_VARIABLE  ||  _confidence[_trace[i]._address] < ANALYSER_CONFIDENCE) continue;
+
+            if(offset == _trace[i]._offset)
+            {
+                onTime = i;
+                continue;
+            }
+
+            offender._mistimed = true;
+            offender._mistimedPC = _trace[i]._address;
+            offender._expected = offset;
+            offender._observed = _trace[i]._offset;
+
+            for(int j=std::max(onTime, 0); j+2<=i; j++)
+            {
+                if(!isEntry(_trace[j])) continue;
+
+                if(offender._entries.size() == ANALYSER_ENTRIES) offender._entries.erase(offender._entries.begin());
+                offender._entries.push_back(_trace[j+2]._address);
+            }
+            break;
+        }
+
+        if(onTime >= 0)
+        {
+            offender._onTime = true;
+            offender._onTimePC = _trace[onTime]._address;
+        }
+
+        return offender;
+    }
+
+    void endLine(int64_t clock)
+    {
+        _line._length = int(clock - _lineStart);
+        _lines++;
+
+        _lineLengths[_line._length]++;
+        _pixelCounts[_line._pixels]++;
+        if(_line._hSyncFall >= 0) _hSyncPulses[_line._length - _line._hSyncFall]++;
+
+        if(_lineNumber >= 0)
+        {
+            int index = std::min(_lineNumber, ANALYSER_LINES - 1);
+            int bucket = std::min(std::max(_line._length - HLINE_END + ANALYSER_SPREAD, 0), ANALYSER_BUCKETS - 1);
+            _lineHistograms[index][bucket]++;
+            _frameLines[index] = _line;
+            _frameLength = index + 1;
+        }
+
+        if(_line._length == HLINE_END)
+        {
+            learnLine();
+        }
+        else
+        {
+            _linesInError++;
+            if(_offenders.size() < ANALYSER_OFFENDERS) _offenders.push_back(findOffender());
+        }
+
+        if(_lineNumber >= 0) _lineNumber++;
+    }
+
+    void cycle(const Cpu::State& S, const Cpu::State& T, int64_t clock)
+    {
+        if(!_analysing) return;
+
+        // S._IR runs this cycle, it was fetched from the previous cycle's PC
+        uint16_t address = _fetchPC;
+        _fetchPC = S._PC;
+
+        int hSync = (T._OUT & 0x40) - (S._OUT & 0x40);
+        int vSync = (T._OUT & 0x80) - (S._OUT & 0x80);
+
+        if(_lineStart >= 0)
+        {
+            int offset = int(clock - _lineStart);
+            if(_traceLength < ANALYSER_TRACE) _trace[_traceLength++] = {address, S._IR, offset};
+
+            // ld [y,x++],out and friends
+            if((S._IR & 0x1F) == 0x1D  &&  (S._IR >> 5) < 6) _line._pixels++;
+
+            if(hSync < 0) _line._hSyncFall = offset;
+            if(vSync > 0)
+            {
+                _line._vSyncRise = offset;
+                if(_lineNumber >= 0) _vSyncPulses[_lineNumber]++;
+            }
+
+            // The line with the falling vSync edge is line 0 of the next frame
+            if(vSync < 0)
+            {
+                _line._vSyncFall = offset;
+                if(_lineNumber >= 0)
+                {
+                    _frames++;
+                    _linesPerFrame[_lineNumber]++;
+                    _lastFrame.assign(&_frameLines[0], &_frameLines[_frameLength]);
+                }
+                _lineNumber = 0;
+                _frameLength = 0;
+            }
+
+            if(hSync > 0) endLine(clock);
+        }
+
+        if(hSync > 0)
+        {
+            _lineStart = clock;
+            _traceLength = 0;
+            _line = Line();
+            _line._start = clock;
+        }
+    }
+
+
+    void writeHistogram(std::ofstream& outfile, const char* title, const char* units, const Histogram& histogram)
+    {
+        char buffer[256];
+        uint64_t total = 0;
+        for(auto it=histogram.begin(); it!=histogram.end(); ++it) total += it->second;
+
+        outfile << title << "\n";
+        for(auto it=histogram.begin(); it!=histogram.end(); ++it)
+        {
+            sprintf(buffer, "  %6d %-6s : %12" PRIu64 " : %7.3f%%\n", it->first, units, it->second, 100.0 * double(it->second) / double(total));
+            outfile << buffer;
+        }
+        if(histogram.empty()) outfile << "  none\n";
+        outfile << "\n";
+    }
+
+    bool writeReport(const std::string& filename)
+    {
+        std::ofstream outfile(filename);
+        if(!outfile.is_open())
+        {
+            fprintf(stderr, "Analyser::writeReport() : failed to create '%s'\n", filename.c_str());
+            return false;
+        }
+
+        char buffer[256];
+        outfile << "Gigatron video timing report\n\n";
+        sprintf(buffer, "Frames %" PRIu64 " : lines %" PRIu64 " : lines in error %" PRIu64 " : expected %d cycles per line, %d lines per frame\n\n", _frames, _lines, _linesInError, HLINE_END, SCAN_LINES);
+        outfile << buffer;
+
+        writeHistogram(outfile, "Line length, rising hSync to rising hSync", "cycles", _lineLengths);
+        writeHistogram(outfile, "hSync pulse, falling hSync to rising hSync", "cycles", _hSyncPulses);
+        writeHistogram(outfile, "Pixels per line", "pixels", _pixelCounts);
+        writeHistogram(outfile, "Frame length, falling vSync to falling vSync", "lines", _linesPerFrame);
+        writeHistogram(outfile, "vSync pulse, falling vSync to rising vSync", "lines", _vSyncPulses);
+
+        // Only the lines of the frame that were ever the wrong length
+        sprintf(buffer, "Line length per line of the frame, lines that were ever not %d cycles, (<=%d ... >=%d)\n", HLINE_END, HLINE_END - ANALYSER_SPREAD, HLINE_END + ANALYSER_SPREAD);
+        outfile << buffer;
+        bool anyLines = false;
+        for(int i=0; i<ANALYSER_LINES; i++)
+        {
+            uint32_t* buckets = _lineHistograms[i];
+            uint32_t good = buckets[ANALYSER_SPREAD], total = 0;
+            for(int j=0; j<ANALYSER_BUCKETS; j++) total += buckets[j];
+            if(total == good) continue;
+
+            anyLines = true;
+            sprintf(buffer, (i < ANALYSER_LINES - 1) ? "  line %3d :" : "  line %3d+:", i);
+            outfile << buffer;
+            for(int j=0; j<ANALYSER_BUCKETS; j++)
+            {
+                sprintf(buffer, " %u", buckets[j]);
+                outfile << buffer;
+            }
+            outfile << "\n";
+        }
+        if(!anyLines) outfile << "  none\n";
+        outfile << "\n";
+
+        sprintf(buffer, "First %d lines in error\n", ANALYSER_OFFENDERS);
+        outfile << buffer;
+        for(int i=0; i<int(_offenders.size()); i++)
+        {
+            const Offender& offender = _offenders[i];
+            if(offender._line >= 0)
+            {
+                sprintf(buffer, "  frame %6" PRIu64 " : line %3d : length %4d : pixels %3d :", offender._frame, offender._line, offender._length, offender._pixels);
+            }
+            else
+            {
+                sprintf(buffer, "  frame      ? : line   ? : length %4d : pixels %3d :", offender._length, offender._pixels);
+            }
+            outfile << buffer;
+
+            if(offender._mistimed)
+            {
+                sprintf(buffer, " first mistimed PC %04x, cycle %d expected %d :", offender._mistimedPC, offender._observed, offender._expected);
+                outfile << buffer;
+            }
+            else
+            {
+                outfile << " no mistimed PC :";
+            }
+
+            if(offender._onTime)
+            {
+                sprintf(buffer, " last on time PC %04x", offender._onTimePC);
+                outfile << buffer;
+            }
+            else
+            {
+                outfile << " no on time PC";
+            }
+
+            if(offender._entries.size())
+            {
+                outfile << " : entered";
+                for(int j=0; j<int(offender._entries.size()); j++)
+                {
+                    sprintf(buffer, " %04x", offender._entries[j]);
+                    outfile << buffer;
+                }
+            }
+            outfile << "\n";
+        }
+        if(_offenders.empty()) outfile << "  none\n";
+        outfile << "\n";
+
+        outfile << "Last complete frame, edges are cycles into the line\n";
+        for(int i=0; i<int(_lastFrame.size()); i++)
+        {
+            const Line& line = _lastFrame[i];
+            sprintf(buffer, "  line %3d : clock %12" PRId64 " : length %4d : pixels %3d : hSync fall %4d : vSync fall %4d : vSync rise %4d%s\n", i, line._start, line._length, line._pixels,
+                                                                                                                                                   line._hSyncFall, line._vSyncFall, line._vSyncRise,
+                                                                                                                                                   (line._length != HLINE_END) ? " : error" : "");
+            outfile << buffer;
+        }
+        if(_lastFrame.empty()) outfile << "  none\n";
+
+        if(outfile.bad()  ||  outfile.fail())
+        {
+            fprintf(stderr, "Analyser::writeReport() : write error in '%s'\n", filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}
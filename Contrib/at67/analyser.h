@@ -0,0 +1,83 @@
+#ifndef ANALYSER_H
+#define ANALYSER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "timing.h"
+
+
+#define ANALYSER_FILE       "timing.txt"
+
+// Every line of a frame has its own histogram, lines past the end of a normal frame share the last one
+#define ANALYSER_LINES      (SCAN_LINES + 1)
+
+// Line lengths from HLINE_END-ANALYSER_SPREAD to HLINE_END+ANALYSER_SPREAD, the first and last buckets catch everything further out
+#define ANALYSER_SPREAD     8
+#define ANALYSER_BUCKETS    (ANALYSER_SPREAD*2 + 1)
+
+// Cycles of each line that are traced, only the start of a longer line is checked for mistimed instructions
+#define ANALYSER_TRACE      1024
+#define ANALYSER_OFFENDERS  64
+#define ANALYSER_ENTRIES    8
+
+// Good lines an address has to have run on, always on the same cycle, before it is trusted to be part of the video loop
+#define ANALYSER_CONFIDENCE 16
+
+
+namespace Analyser
+{
+    // One scanline, from the cycle after a rising hSync edge up to and including the next one, so a good line's rising edge is on
+    // cycle HLINE_END; the edges are cycles into the line, -1 when the line didn't have one
+    struct Line
+    {
+        int64_t _start = 0;
+        int _length = 0;
+        int _pixels = 0;
+        int _hSyncFall = -1;
+        int _vSyncFall = -1;
+        int _vSyncRise = -1;
+    };
+
+    // A line that wasn't HLINE_END cycles; the ROM's video loop runs each of its instructions on the same cycle of every good line, so
+    // the first of those to come early or late is where the time went and the code between the last one on time and it is what ran
+    // too long or too short, _entries is the last of the vCPU instructions and far jump targets, (i.e. SYS routines), entered in between
+    struct Offender
+    {
+        uint64_t _frame = 0;
+        int _line = -1;
+        int _length = 0;
+        int _pixels = 0;
+        bool _mistimed = false;
+        bool _onTime = false;
+        uint16_t _mistimedPC = 0x0000;
+        uint16_t _onTimePC = 0x0000;
+        int _expected = 0;
+        int _observed = 0;
+        std::vector<uint16_t> _entries;
+    };
+
+
+    bool getAnalysing(void);
+    uint64_t getFramesAnalysed(void);
+    uint64_t getLinesAnalysed(void);
+    uint64_t getLinesInError(void);
+
+    // Nothing is measured until the first rising hSync edge, or counted per line until the first falling vSync edge
+    void start(void);
+
+    // Writes the report when there is anything to report
+    void stop(const std::string& filename=ANALYSER_FILE);
+
+    // The machine jumped, (reset, restored or rewound), nothing is measured again until the next rising hSync edge
+    void resync(void);
+
+    // While analysing main() runs the CPU a cycle at a time and hands over every one, S before and T after, clock is the cycle's clock
+    void cycle(const Cpu::State& S, const Cpu::State& T, int64_t clock);
+
+    bool writeReport(const std::string& filename);
+}
+
+#endif
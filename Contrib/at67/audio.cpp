@@ -1,60 +1,255 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <vector>
 #include <algorithm>
 
 #include "cpu.h"
 #include "audio.h"
 #include "timing.h"
-#include "editor.h"
 #include "midi/music.h"
 
+#ifndef HEADLESS
+#include <atomic>
+
+#include "spsc.h"
+
 #include <SDL.h>
+#endif
 
 
 namespace Audio
 {
+    struct BuiltinScore
+    {
+        const uint8_t* _data;
+        uint32_t _size;
+    };
+
+    BuiltinScore _builtinScores[] = {{musicMidi00, uint32_t(sizeof(musicMidi00))}};
+
+    std::vector<Score> _scores;
     int _scoreIndex = 0;
-    SDL_AudioDeviceID _audioDevice = 1;
+    uint16_t _scoreAddress = 0x0000;
+    int16_t _midiDelay = 0;
+    bool _musicPlaying = false;
+
+
+#ifndef HEADLESS
+    SDL_AudioDeviceID _audioDevice = 0;
+    SDL_AudioSpec _audioSpec;
+
+    // Written by the emulation thread at every hSync, read by the audio callback a device buffer at a time
+    Spsc::Queue<uint8_t, AUDIO_RING_SIZE> _ring;
+    std::atomic<uint64_t> _underruns(0);
+    std::atomic<uint64_t> _overruns(0);
+    std::atomic<uint64_t> _discarded(0);
+    std::atomic<bool> _rateControl(true);
+    std::atomic<double> _latency(0.0);
+    std::atomic<double> _drift(0.0);
+
+    // Audio callback only, linear interpolation between the current and next scanline samples with a 16.16 phase
+    std::vector<uint8_t> _block;
+    uint32_t _phase = 0;
+    uint32_t _step = 0;
+    int _current = 0;
+    int _next = 0;
+
+    // Audio callback only, the rate controller's smoothed fill level and integral term
+    double _fill = TIMING_AUDIO_TARGET;
+    double _integral = 0.0;
+
+
+    uint32_t getQueuedSamples(void) {return Spsc::size(_ring);}
+    int getDeviceFrequency(void) {return _audioSpec.freq;}
+    uint64_t getUnderruns(void) {return _underruns;}
+    uint64_t getOverruns(void) {return _overruns;}
+    uint64_t getDiscarded(void) {return _discarded;}
+    double getLatency(void) {return _latency;}
+    double getDrift(void) {return _drift;}
+
+    void setRateControl(bool rateControl) {_rateControl = rateControl;}
+
+
+    int toPcm(uint8_t sample) {return AUDIO_PCM(sample);}
+
+    // Proportional and integral on the smoothed fill level, a few tenths of a percent of pitch is inaudible where dropping or
+    // repeating samples is not; returns the step for this buffer
+    uint32_t rateControl(void)
+    {
+        uint32_t queued = Spsc::size(_ring);
+        if(queued > AUDIO_DISCARD_LEVEL)
+        {
+            uint32_t discard = queued - TIMING_AUDIO_TARGET;
+            for(uint32_t count=discard; count; ) count -= Spsc::pop(_ring, &_block[0], std::min(count, uint32_t(_block.size())));
+            _discarded += discard;
+            queued = TIMING_AUDIO_TARGET;
+            _fill = queued;
+        }
+        _fill += (double(queued) - _fill) * AUDIO_FILL_SMOOTHING;
+
+        double correction = 0.0;
+        if(_rateControl)
+        {
+            double error = (_fill - double(TIMING_AUDIO_TARGET)) / double(TIMING_AUDIO_TARGET);
+            _integral = std::min(std::max(_integral + error*AUDIO_RATE_INTEGRAL, -AUDIO_RATE_CORRECTION), AUDIO_RATE_CORRECTION);
+            correction = std::min(std::max(error*AUDIO_RATE_PROPORTIONAL + _integral, -AUDIO_RATE_CORRECTION), AUDIO_RATE_CORRECTION);
+        }
+
+        _latency = _fill / AUDIO_SCANLINE_RATE + double(_audioSpec.samples) / double(_audioSpec.freq);
+        _drift = correction;
+
+        return uint32_t(double(_step) * (1.0 + correction));
+    }
+
+    // Runs on SDL's audio thread, takes exactly the scanline samples this buffer spans from the ring in one go, (an empty ring holds
+    // the last sample rather than clicking), and interpolates between them at the device rate
+    void audioCallback(void*, uint8_t* stream, int length)
+    {
+        int16_t* output = (int16_t*)stream;
+        int samples = length / int(sizeof(int16_t));
 
-    uint8_t* _score[] = {(uint8_t*)musicMidi00};
-    uint8_t* _scorePtr = (uint8_t*)_score[_scoreIndex];
+        uint32_t step = rateControl();
+        uint32_t needed = uint32_t((uint64_t(_phase) + uint64_t(samples)*step) >> 16);
+        needed = std::min(needed, uint32_t(_block.size()));
+        uint32_t popped = Spsc::pop(_ring, &_block[0], needed);
+        if(popped < needed) _underruns++;
 
+        uint32_t index = 0;
+        for(int i=0; i<samples; i++)
+        {
+            output[i] = int16_t(_current + (((_next - _current) * int(_phase)) >> 16));
+            _phase += step;
+            while(_phase >= 0x00010000)
+            {
+                _phase -= 0x00010000;
+                _current = _next;
+                if(index < popped) _next = toPcm(_block[index++]);
+            }
+        }
+    }
 
     void initialise(void)
     {
         SDL_AudioSpec wanted;
         SDL_zero(wanted);
-        wanted.freq = SCAN_LINES*VSYNC_RATE;
-        //wanted.format = AUDIO_U16;
-        wanted.format = AUDIO_U8;
+        wanted.freq = AUDIO_FREQUENCY;
+        wanted.format = AUDIO_S16SYS;
         wanted.channels = 1;
-        //wanted.samples = 1; //521;
-        //_audioDevice = SDL_OpenAudioDevice(NULL, 0, &wanted, NULL, 0);
-        //if(_audioDevice == 0)
+        wanted.samples = AUDIO_DEVICE_SAMPLES;
+        wanted.callback = audioCallback;
 
-        if(SDL_OpenAudio(&wanted, NULL) < 0)
+        // Whatever rate the device prefers, resampling is ours either way
+        SDL_zero(_audioSpec);
+        _audioDevice = SDL_OpenAudioDevice(NULL, 0, &wanted, &_audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+        if(_audioDevice == 0)
         {
             SDL_Quit();
-            fprintf(stderr, "Audio::initialise() : failed to initialise SDL audio\n");
+            fprintf(stderr, "Audio::initialise() : failed to initialise SDL audio : %s\n", SDL_GetError());
             _EXIT_(EXIT_FAILURE);
         }
-        SDL_PauseAudio(0);
+
+        // Room for the fastest the rate control ever runs
+        _step = uint32_t(AUDIO_SCANLINE_RATE / double(_audioSpec.freq) * 65536.0);
+        _block.resize(size_t((uint64_t(_audioSpec.samples) * _step * (1.0 + AUDIO_RATE_CORRECTION)) / 65536.0) + 2);
+        _rateControl = !Timing::getSlaveToAudio();
+        _current = _next = toPcm(0);
+
+        SDL_PauseAudioDevice(_audioDevice, 0);
     }
 
+    // Every scanline's sample, the audio callback's rate control keeps the ring where it should be
     void playSample(void)
     {
-        double ratio = 1.0;
-        if(Timing::getFrameTime()) ratio = std::max(1.0, VSYNC_TIMING_60 / std::min(Timing::getFrameTime(), VSYNC_TIMING_60));
+        uint8_t sample = (Cpu::getXOUT() & 0xF0) >>4;
+        if(!Spsc::push(_ring, sample)) _overruns++;
+    }
+#endif
+
+
+    int getNumBuiltinScores(void) {return int(sizeof(_builtinScores) / sizeof(_builtinScores[0]));}
+    int getNumQueuedScores(void) {return int(_scores.size());}
+    bool getMusicPlaying(void) {return _musicPlaying;}
+
+
+    void getMusicState(MusicState& musicState)
+    {
+        musicState._scoreIndex = _scoreIndex;
+        musicState._scoreAddress = _scoreAddress;
+        musicState._midiDelay = _midiDelay;
+        musicState._started = _musicPlaying;
+    }
+
+    // The channels and any score in RAM come back with RAM itself, the queue is the user's and stays as it is
+    void setMusicState(const MusicState& musicState)
+    {
+        _scoreIndex = (musicState._scoreIndex >= 0  &&  musicState._scoreIndex < int(_scores.size())) ? musicState._scoreIndex : 0;
+        _scoreAddress = musicState._scoreAddress;
+        _midiDelay = musicState._midiDelay;
+        _musicPlaying = musicState._started  &&  !_scores.empty();
+    }
+
+    uint16_t getScoreStart(const Score& score)
+    {
+        return (score._source == ScoreBuiltin) ? 0x0000 : score._address;
+    }
+
+    // Built in scores come from the host array and wrap rather than read past its end, the others go through Cpu::getRAM()/getROM()
+    uint8_t getScoreByte(const Score& score, uint16_t address)
+    {
+        switch(score._source)
+        {
+            case ScoreBuiltin:
+            {
+                const BuiltinScore& builtin = _builtinScores[score._builtin];
+                return builtin._data[address % builtin._size];
+            }
+
+            case ScoreRam: return Cpu::getRAM(address);
+            case ScoreRom: return Cpu::getROM(address, 1);
+        }
+
+        return 0x00;
+    }
+
+    bool queueBuiltinScore(int index)
+    {
+        if(index < 0  ||  index >= getNumBuiltinScores())
+        {
+            fprintf(stderr, "Audio::queueBuiltinScore() : score %d doesn't exist, there are %d built in scores\n", index, getNumBuiltinScores());
+            return false;
+        }
+
+        Score score;
+        score._source = ScoreBuiltin;
+        score._builtin = index;
+        _scores.push_back(score);
+        if(_scores.size() == 1) _scoreAddress = getScoreStart(score);
+
+        return true;
+    }
 
-        static double skip = 0.0;
-        uint64_t count = uint64_t(skip);
-        skip += 1.0 / ratio;
-        if(uint64_t(skip) > count)
+    void queueScore(ScoreSource source, uint16_t address)
+    {
+        if(source == ScoreBuiltin)
         {
-            uint8_t sample = (Cpu::getXOUT() & 0xF0) >>2;
-            SDL_QueueAudio(_audioDevice, &sample, 1);
+            queueBuiltinScore(address);
+            return;
         }
+
+        Score score;
+        score._source = source;
+        score._address = address;
+        _scores.push_back(score);
+        if(_scores.size() == 1) _scoreAddress = getScoreStart(score);
+    }
+
+    void clearScores(void)
+    {
+        setMusicPlaying(false);
+        _scores.clear();
+        _scoreIndex = 0;
+        _scoreAddress = 0x0000;
     }
 
     void resetChannels(void)
@@ -70,57 +265,49 @@ namespace Audio
         }
     }
 
-    void nextScore(void)
+    void setMusicPlaying(bool playing)
     {
+        if(playing  &&  _scores.empty())
+        {
+            for(int i=0; i<getNumBuiltinScores(); i++) queueBuiltinScore(i);
+        }
+
+        // Stopping leaves the score where it is, the sound timer running out silences the channels a frame later either way
         resetChannels();
+        _midiDelay = 0;
+        _musicPlaying = playing  &&  !_scores.empty();
+    }
 
-        if(++_scoreIndex >= 1) _scoreIndex = 0;
-        _scorePtr = (uint8_t*)_score[_scoreIndex];
+    void nextScore(void)
+    {
+        if(_scores.empty()) return;
+
+        resetChannels();
+        if(++_scoreIndex >= int(_scores.size())) _scoreIndex = 0;
+        _scoreAddress = getScoreStart(_scores[_scoreIndex]);
+        _midiDelay = 0;
     }
 
     void playMusic(void)
     {
-        if(!Editor::getStartMusic()) return;
-
-        static bool firstTime = true;
-        if(firstTime == true)
-        {
-            firstTime = false;
-            resetChannels();            
-
-            // Signed -31 to +31 sine wave
-            //for(int i=0; i<64; i++)
-            //{
-            //    Cpu::setRAM(0x700+i, int8_t(sinf(float(i) / 64.0f * 2.0f* 3.141529f)*31.0f));
-            //}
-        }
+        if(!_musicPlaying) return;
 
-        static int16_t midiDelay = 0;
-        static uint64_t prevFrameCounter = 0;
-        double frameTime = double(SDL_GetPerformanceCounter() - prevFrameCounter) / double(SDL_GetPerformanceFrequency());
-        if(frameTime > VSYNC_TIMING_60)
-        {
-            prevFrameCounter = SDL_GetPerformanceCounter();        
-            if(midiDelay)
-            {
-                midiDelay--; 
-                frameTime = 0.0;
+        // Keeps the ROM's sound loop running for another frame
+        Cpu::setRAM(GIGA_SOUND_TIMER, 0x01);
 
-                // Start audio
-                Cpu::setRAM(GIGA_SOUND_TIMER, 0x01);
-            }
-        }
+        if(_midiDelay) _midiDelay--;
 
-        while(midiDelay == 0)
+        for(int i=0; i<AUDIO_MUSIC_COMMANDS  &&  _midiDelay == 0; i++)
         {
-            uint8_t command = *_scorePtr++;
+            const Score& score = _scores[_scoreIndex];
+            uint8_t command = getScoreByte(score, _scoreAddress++);
             if(command & 0x80)
             {
                 // Start note
                 if((command & 0xF0) == 0x90)
                 {
                     uint8_t channel = command & (GIGA_SOUND_CHANNELS - 1);  // spec supports up to 16 channels, Gigatron supports 4
-                    uint16_t note = *_scorePtr++;
+                    uint16_t note = getScoreByte(score, _scoreAddress++);
                     note = (note - 10) * 2 - 2;
                     note = Cpu::getROM16(note + 0x0900, 1);
                     Cpu::setRAM(GIGA_CH0_KEY_L + channel*GIGA_CHANNEL_OFFSET, uint8_t(note & 0x00FF));
@@ -133,19 +320,24 @@ namespace Audio
                     Cpu::setRAM(GIGA_CH0_KEY_L + channel*GIGA_CHANNEL_OFFSET, 0x00);
                     Cpu::setRAM(GIGA_CH0_KEY_H + channel*GIGA_CHANNEL_OFFSET, 0x00);
                 }
-                // Segment command
+                // Segment command, a Gigatron address in the same space as the score, a jump back to the start is the end of the score
                 else if((command & 0xF0) == 0xD0)
                 {
-                    uint16_t segment = *_scorePtr++;
-                    segment |= (((*_scorePtr++) <<8) & 0xFF00);
-                    _scorePtr = (uint8_t*)(uintptr_t)segment;
+                    uint16_t segment = getScoreByte(score, _scoreAddress++);
+                    segment |= (getScoreByte(score, _scoreAddress++) <<8) & 0xFF00;
+                    if(segment == getScoreStart(score)  &&  _scores.size() > 1)
+                    {
+                        nextScore();
+                        continue;
+                    }
+                    _scoreAddress = segment;
                 }
             }
-            // Delay n milliseconds where n = 8bit value
+            // Delay n frames where n = 8bit value
             else
             {
-                midiDelay = command;
+                _midiDelay = command;
             }
         }
     }
-}
\ No newline at end of file
+}
@@ -1,6 +1,10 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include <stdint.h>
+
+#include "timing.h"
+
 
 #define GIGA_SOUND_TIMER     0x002C
 #define GIGA_SOUND_CHANNELS  4
@@ -34,13 +38,96 @@
 #define GIGA_CH3_OSC_L  0x04FE
 #define GIGA_CH3_OSC_H  0x04FF
 
+// One 4 bit sample per scanline, resampled in blocks to whatever rate the device runs at
+#define AUDIO_SCANLINE_RATE   (double(CLOCK_FREQ) / double(HLINE_END))
+#define AUDIO_FREQUENCY       48000
+#define AUDIO_DEVICE_SAMPLES  512
+#define AUDIO_AMPLITUDE       512
+
+// 4 bit XOUT sample to signed 16 bit PCM, centred on zero
+#define AUDIO_PCM(sample)     ((int(sample)*2 - 15) * AUDIO_AMPLITUDE)
+
+// Samples in flight between the emulation thread and the audio callback, must be a power of 2
+#define AUDIO_RING_SIZE       8192
+
+// Rate control trims the resampling step by up to AUDIO_RATE_CORRECTION to hold the ring at TIMING_AUDIO_TARGET, the fill level is
+// smoothed over a few frames first; a ring this far over, (speed hacks), is cut straight back to the target instead
+#define AUDIO_RATE_CORRECTION    0.005
+#define AUDIO_RATE_PROPORTIONAL  0.005
+#define AUDIO_RATE_INTEGRAL      0.00002
+#define AUDIO_FILL_SMOOTHING     0.05
+#define AUDIO_DISCARD_LEVEL      (TIMING_AUDIO_TARGET*4)
+
+// Most score commands processed in one frame, a score of nothing but zero delays can't hang the emulator
+#define AUDIO_MUSIC_COMMANDS     256
+
 
 namespace Audio
 {
+    // Where a queued score's bytes come from; built in scores, (F8 and gtemu-headless -music), are read straight from the host arrays in
+    // midi/music.h, addressed as if loaded at 0x0000 which is the start address gtmidi generates them with, so their segment commands
+    // work unchanged; only RAM and ROM scores are read through the CPU, i.e. whatever the emulated machine holds at their address
+    enum ScoreSource {ScoreBuiltin, ScoreRam, ScoreRom};
+
+    struct Score
+    {
+        ScoreSource _source = ScoreBuiltin;
+        int _builtin = 0;
+        uint16_t _address = 0x0000;
+    };
+
+    // Music sequencer, the queue position, the Gigatron address within that score and the frames left until its next command, so
+    // that it can be saved and restored along with the RAM that holds both the channels and the score
+    struct MusicState
+    {
+        int _scoreIndex = 0;
+        uint16_t _scoreAddress = 0x0000;
+        int16_t _midiDelay = 0;
+        bool _started = false;
+    };
+
+
+    void getMusicState(MusicState& musicState);
+    void setMusicState(const MusicState& musicState);
+
+#ifndef HEADLESS
     void initialise(void);
     void playSample(void);
+
+    // Samples waiting in the ring for the audio callback, at the scanline rate
+    uint32_t getQueuedSamples(void);
+
+    // Published by the audio callback; latency is the smoothed ring fill plus one device buffer, in seconds, i.e. how long a sample
+    // takes from playSample() to the speaker, drift is the fraction the resampling currently runs fast, (positive), or slow to hold
+    // it there, i.e. how far the emulated clock is drifting from the device's
+    double getLatency(void);
+    double getDrift(void);
+    int getDeviceFrequency(void);
+
+    // Callbacks that ran out of samples and held the last one, samples the ring had no room for and samples cut to get back to target
+    uint64_t getUnderruns(void);
+    uint64_t getOverruns(void);
+    uint64_t getDiscarded(void);
+
+    // Off while frame pacing is slaved to the audio, so that only one side corrects for drift
+    void setRateControl(bool rateControl);
+#endif
+
+    int getNumBuiltinScores(void);
+    int getNumQueuedScores(void);
+
+    // Scores play in the order they were queued, a score that jumps back to its own start moves on to the next one and the last one
+    // moves on to the first; playing with nothing queued queues every built in score, (a built in score's address is its index)
+    bool queueBuiltinScore(int index);
+    void queueScore(ScoreSource source, uint16_t address);
+    void clearScores(void);
+
+    bool getMusicPlaying(void);
+    void setMusicPlaying(bool playing);
+
+    // Called on every falling vSync edge, the score's delays are in frames so playback follows the emulated clock whatever the speed
     void playMusic(void);
     void nextScore(void);
 }
 
-#endif
+#endif
\ No newline at end of file
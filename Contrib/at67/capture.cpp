@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+
+#ifndef STAND_ALONE
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "spsc.h"
+#endif
+
+#include "timing.h"
+#include "capture.h"
+#include "codec.h"
+
+
+namespace Capture
+{
+    void encodeFrame(const Frame& frame, const Frame& previous, std::vector<uint8_t>& record)
+    {
+        record.clear();
+        Codec::put32(record, frame._number);
+        Codec::put16(record, 0);
+        Codec::put32(record, 0);
+
+        int numLines = 0;
+        for(int y=0; y<CAPTURE_HEIGHT; y++)
+        {
+            const uint8_t* line = &frame._pixels[y * CAPTURE_WIDTH];
+            const uint8_t* base = &previous._pixels[y * CAPTURE_WIDTH];
+            if(memcmp(line, base, CAPTURE_WIDTH) == 0) continue;
+
+            Codec::encodeDelta(y, line, base, CAPTURE_WIDTH, record);
+            numLines++;
+        }
+
+        uint32_t length = uint32_t(record.size() - CAPTURE_RECORD);
+        record[4] = uint8_t(numLines);
+        record[5] = uint8_t(numLines >> 8);
+        for(int i=0; i<4; i++) record[6 + i] = uint8_t(length >> (i*8));
+    }
+
+    bool decodeFrame(const std::vector<uint8_t>& record, int numLines, Frame& frame)
+    {
+        return Codec::decodeDeltas(record, numLines, frame._pixels, frame._pixels, CAPTURE_WIDTH, CAPTURE_HEIGHT);
+    }
+
+    bool openFile(const std::string& filename, std::ifstream& infile)
+    {
+        infile.open(filename, std::ios::binary | std::ios::in);
+        if(!infile.is_open())
+        {
+            fprintf(stderr, "Capture::openFile() : failed to open '%s'\n", filename.c_str());
+            return false;
+        }
+
+        uint8_t header[CAPTURE_HEADER];
+        infile.read((char*)header, CAPTURE_HEADER);
+        if(infile.gcount() != CAPTURE_HEADER  ||  memcmp(header, CAPTURE_MAGIC, 4)  ||  Codec::get16(&header[4]) != CAPTURE_VERSION  ||
+           Codec::get16(&header[6]) != CAPTURE_WIDTH  ||  Codec::get16(&header[8]) != CAPTURE_HEIGHT)
+        {
+            fprintf(stderr, "Capture::openFile() : '%s' is not a version %d capture\n", filename.c_str(), CAPTURE_VERSION);
+            return false;
+        }
+
+        return true;
+    }
+
+    bool readFrame(std::ifstream& infile, Frame& frame)
+    {
+        uint8_t header[CAPTURE_RECORD];
+        infile.read((char*)header, CAPTURE_RECORD);
+        if(infile.gcount() != CAPTURE_RECORD) return false;
+
+        uint32_t length = Codec::get32(&header[6]);
+        std::vector<uint8_t> record(length);
+        if(length) infile.read((char*)&record[0], length);
+        if(length  &&  uint32_t(infile.gcount()) != length)
+        {
+            fprintf(stderr, "Capture::readFrame() : frame %u is truncated\n", Codec::get32(&header[0]));
+            return false;
+        }
+
+        if(!decodeFrame(record, Codec::get16(&header[4]), frame))
+        {
+            fprintf(stderr, "Capture::readFrame() : frame %u is corrupt\n", Codec::get32(&header[0]));
+            return false;
+        }
+        frame._number = Codec::get32(&header[0]);
+
+        return true;
+    }
+
+
+#ifndef STAND_ALONE
+    // Emulation thread side, the screen as it stands, (lines that aren't redrawn keep their contents, just like the display)
+    Frame _screen;
+    uint32_t _frameNumber = 0;
+
+    // Slots cycle from the free queue, to the emulation thread, to the full queue, to the writer thread and back again
+    Frame _frames[CAPTURE_FRAMES];
+    Spsc::Queue<int, CAPTURE_FRAMES> _freeFrames;
+    Spsc::Queue<int, CAPTURE_FRAMES> _fullFrames;
+
+    std::atomic<bool> _capturing(false);
+    std::atomic<bool> _stopping(false);
+    std::atomic<uint32_t> _framesWritten(0);
+    std::atomic<uint32_t> _framesDropped(0);
+
+    std::ofstream _outfile;
+    std::string _filename;
+    std::thread _writer;
+
+
+    bool getCapturing(void) {return _capturing;}
+    uint32_t getFramesWritten(void) {return _framesWritten;}
+    uint32_t getFramesDropped(void) {return _framesDropped;}
+
+
+    void writer(void)
+    {
+        Frame previous;
+        std::vector<uint8_t> record;
+        record.reserve(CAPTURE_RECORD + CAPTURE_HEIGHT*(CAPTURE_WIDTH + CAPTURE_WIDTH/128 + 4));
+
+        for(;;)
+        {
+            // Read before popping, every frame is queued before stopping is set so an empty queue after it means there are no more
+            bool stopping = _stopping.load(std::memory_order_acquire);
+
+            int slot;
+            if(!Spsc::pop(_fullFrames, slot))
+            {
+                if(stopping) break;
+
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+
+            encodeFrame(_frames[slot], previous, record);
+            memcpy(previous._pixels, _frames[slot]._pixels, sizeof(previous._pixels));
+            Spsc::push(_freeFrames, slot);
+
+            _outfile.write((const char*)&record[0], record.size());
+            _framesWritten++;
+        }
+
+        _outfile.close();
+    }
+
+    bool start(const std::string& filename)
+    {
+        if(_capturing) return false;
+
+        _outfile.open(filename, std::ios::binary | std::ios::out);
+        if(!_outfile.is_open())
+        {
+            fprintf(stderr, "Capture::start() : failed to open '%s'\n", filename.c_str());
+            return false;
+        }
+
+        std::vector<uint8_t> header;
+        for(int i=0; i<4; i++) Codec::put8(header, CAPTURE_MAGIC[i]);
+        Codec::put16(header, CAPTURE_VERSION);
+        Codec::put16(header, CAPTURE_WIDTH);
+        Codec::put16(header, CAPTURE_HEIGHT);
+        Codec::put32(header, CLOCK_FREQ);
+        Codec::put32(header, SCAN_LINES*HLINE_END);
+        _outfile.write((const char*)&header[0], header.size());
+
+        // The writer isn't running, so both queues can be reset from here
+        int slot;
+        while(Spsc::pop(_fullFrames, slot));
+        while(Spsc::pop(_freeFrames, slot));
+        for(int i=0; i<CAPTURE_FRAMES; i++) Spsc::push(_freeFrames, i);
+
+        _filename = filename;
+        _frameNumber = 0;
+        _framesWritten = 0;
+        _framesDropped = 0;
+        _stopping = false;
+        _writer = std::thread(writer);
+        _capturing = true;
+
+        return true;
+    }
+
+    void stop(void)
+    {
+        if(!_capturing) return;
+
+        _capturing = false;
+        _stopping.store(true, std::memory_order_release);
+        _writer.join();
+
+        if(_outfile.bad()  ||  _outfile.fail())
+        {
+            fprintf(stderr, "Capture::stop() : write error in '%s'\n", _filename.c_str());
+            return;
+        }
+        fprintf(stderr, "Capture::stop() : %u frames written to '%s', %u dropped\n", uint32_t(_framesWritten), _filename.c_str(), uint32_t(_framesDropped));
+    }
+
+    void captureScanline(const uint8_t* scanline, int length, int vgaY)
+    {
+        if(!_capturing  ||  vgaY < 0  ||  vgaY >= CAPTURE_HEIGHT*4  ||  (vgaY % 4) != 0) return;
+
+        // Sync bits off, what a short line didn't draw stays as it was
+        uint8_t* line = &_screen._pixels[(vgaY/4) * CAPTURE_WIDTH];
+        if(length > CAPTURE_WIDTH) length = CAPTURE_WIDTH;
+        for(int i=0; i<length; i++) line[i] = scanline[i] & 0x3F;
+    }
+
+    void endFrame(void)
+    {
+        if(!_capturing) return;
+
+        // Never wait on the writer, a frame with no free slot is dropped and shows up as a gap in the frame numbers
+        int slot;
+        if(!Spsc::pop(_freeFrames, slot))
+        {
+            _framesDropped++;
+            _frameNumber++;
+            return;
+        }
+
+        Frame& frame = _frames[slot];
+        memcpy(frame._pixels, _screen._pixels, sizeof(frame._pixels));
+        frame._number = _frameNumber++;
+        Spsc::push(_fullFrames, slot);
+    }
+#endif
+}
@@ -0,0 +1,63 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+
+#define CAPTURE_FILE     "capture.gtv"
+#define CAPTURE_MAGIC    "GTVC"
+#define CAPTURE_VERSION  1
+
+#define CAPTURE_WIDTH    160
+#define CAPTURE_HEIGHT   120
+#define CAPTURE_HEADER   18
+#define CAPTURE_RECORD   10
+
+// Frames in flight between the emulation thread and the writer thread, must be a power of 2
+#define CAPTURE_FRAMES   64
+
+
+namespace Capture
+{
+    // One frame of 6 bit colour indices, (OUT without the sync bits), taken from the first VGA line of every four as that is the one
+    // every scanline mode draws; the number counts emulated frames from the start of the capture
+    struct Frame
+    {
+        uint32_t _number = 0;
+        uint8_t _pixels[CAPTURE_WIDTH * CAPTURE_HEIGHT] = {0};
+    };
+
+
+    // After an 18 byte header, (magic, version, width, height, clock frequency and cycles per frame), each frame is a record of its
+    // number, the number of lines that changed and a 32 bit length, followed by every changed line as its line number, a 16 bit length
+    // and the line XOR'ed with the same line of the previous frame and run length encoded, (PackBits, as in save states); the first
+    // frame is encoded against all zeros, a gap in the frame numbers is frames the writer couldn't keep up with
+    void encodeFrame(const Frame& frame, const Frame& previous, std::vector<uint8_t>& record);
+
+    // Decodes a record's lines on top of the previous frame
+    bool decodeFrame(const std::vector<uint8_t>& record, int numLines, Frame& frame);
+
+    bool openFile(const std::string& filename, std::ifstream& infile);
+
+    // Frame must hold the previous frame, (or zeros for the first), returns false at the end of the file or on a damaged record
+    bool readFrame(std::ifstream& infile, Frame& frame);
+
+#ifndef STAND_ALONE
+    bool getCapturing(void);
+    uint32_t getFramesWritten(void);
+    uint32_t getFramesDropped(void);
+
+    // Starts the writer thread, frames are only ever dropped, never waited for, if it falls behind
+    bool start(const std::string& filename=CAPTURE_FILE);
+    void stop(void);
+
+    // main() hands over every scanline and every falling vSync edge, both do nothing unless capturing
+    void captureScanline(const uint8_t* scanline, int length, int vgaY);
+    void endFrame(void);
+#endif
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+#include <vector>
+
+
+namespace Codec
+{
+    // Little endian, field by field, so that files don't depend on struct layout, (save states, captures and .wav)
+    inline void put8(std::vector<uint8_t>& buffer, uint8_t value) {buffer.push_back(value);}
+    inline void put16(std::vector<uint8_t>& buffer, uint16_t value) {put8(buffer, uint8_t(value)); put8(buffer, uint8_t(value >> 8));}
+    inline void put32(std::vector<uint8_t>& buffer, uint32_t value) {put16(buffer, uint16_t(value)); put16(buffer, uint16_t(value >> 16));}
+    inline void put64(std::vector<uint8_t>& buffer, uint64_t value) {put32(buffer, uint32_t(value)); put32(buffer, uint32_t(value >> 32));}
+
+    inline uint16_t get16(const uint8_t* data) {return uint16_t(data[0] | (data[1] << 8));}
+    inline uint32_t get32(const uint8_t* data) {return uint32_t(get16(data)) | (uint32_t(get16(&data[2])) << 16);}
+
+
+    // A block is its index, a 16 bit length and the block XOR'ed with its base, run length encoded, (PackBits: n < 128 is n+1 literals,
+    // n > 128 is 257-n repeats of the next byte); snapshots encode pages of RAM and ROM with it and captures lines of pixels
+    inline void encodeDelta(int index, const uint8_t* data, const uint8_t* base, int size, std::vector<uint8_t>& blocks)
+    {
+        blocks.push_back(uint8_t(index));
+        size_t lengthIndex = blocks.size();
+        blocks.push_back(0);
+        blocks.push_back(0);
+
+        int i = 0;
+        while(i < size)
+        {
+            uint8_t delta = data[i] ^ base[i];
+            int run = 1;
+            while(i + run < size  &&  run < 128  &&  uint8_t(data[i + run] ^ base[i + run]) == delta) run++;
+            if(run > 1)
+            {
+                blocks.push_back(uint8_t(257 - run));
+                blocks.push_back(delta);
+                i += run;
+                continue;
+            }
+
+            size_t countIndex = blocks.size();
+            blocks.push_back(0);
+            int count = 0;
+            while(i < size  &&  count < 128  &&  !(i + 1 < size  &&  (data[i + 1] ^ base[i + 1]) == (data[i] ^ base[i])))
+            {
+                blocks.push_back(data[i] ^ base[i]);
+                i++;
+                count++;
+            }
+            blocks[countIndex] = uint8_t(count - 1);
+        }
+
+        size_t length = blocks.size() - lengthIndex - 2;
+        blocks[lengthIndex + 0] = uint8_t(length & 0x00FF);
+        blocks[lengthIndex + 1] = uint8_t((length >> 8) & 0x00FF);
+    }
+
+    // Decodes every block in a list on top of the base image, (base and data can be the same image), fails on anything malformed
+    inline bool decodeDeltas(const std::vector<uint8_t>& blocks, int numBlocks, const uint8_t* base, uint8_t* data, int blockSize, int maxBlocks)
+    {
+        size_t index = 0;
+        for(int b=0; b<numBlocks; b++)
+        {
+            if(index + 3 > blocks.size()) return false;
+            int block = blocks[index];
+            size_t length = get16(&blocks[index + 1]);
+            index += 3;
+            if(block >= maxBlocks  ||  index + length > blocks.size()) return false;
+
+            uint8_t* dst = &data[block * blockSize];
+            const uint8_t* src = &base[block * blockSize];
+            size_t end = index + length;
+            int i = 0;
+            while(index < end)
+            {
+                uint8_t n = blocks[index++];
+                if(n < 128)
+                {
+                    if(i + n + 1 > blockSize  ||  index + n + 1 > end) return false;
+                    for(int j=0; j<=n; j++, i++) dst[i] = src[i] ^ blocks[index++];
+                }
+                else if(n > 128)
+                {
+                    int run = 257 - n;
+                    if(i + run > blockSize  ||  index >= end) return false;
+                    uint8_t value = blocks[index++];
+                    for(int j=0; j<run; j++, i++) dst[i] = src[i] ^ value;
+                }
+            }
+            if(i != blockSize) return false;
+        }
+
+        return index == blocks.size();
+    }
+}
+
+#endif
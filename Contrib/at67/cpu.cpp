@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <vector>
@@ -10,10 +12,13 @@
 #include "cpu.h"
 
 #ifndef STAND_ALONE
+#ifndef HEADLESS
 #include <SDL.h>
 #include "editor.h"
-#include "timing.h"
 #include "graphics.h"
+#endif
+#include "timing.h"
+#include "vcpu.h"
 #include "gigatron_0x1c.h"
 #endif
 
@@ -30,21 +35,66 @@
 
 namespace Cpu
 {
-    int _vCpuInstPerFrame = 0;
-    int _vCpuInstPerFrameMax = 0;
-    float _vCpuUtilisation = 0.0;
+    typedef void (*Opcode)(Machine& M, const State& S, State& T);
+
+    // Every machine shares the ROM, the translation cache built from it and the opcode tables, the rest of their state is their own
+    uint8_t _ROM[ROM_SIZE][2];
+    Machine _mainMachine;
+    thread_local Machine* _machine = &_mainMachine;
+
+    Opcode _opcodes[256];
 
-    int64_t _clock = -2;
-    uint8_t _IN = 0xFF, _XOUT = 0x00;
-    uint8_t _ROM[ROM_SIZE][2], _RAM[RAM_SIZE];
+    // Pre-decoded ROM, one page of 256 instructions is translated on first use and dropped whenever that page is written,
+    // each entry holds the threaded handler for its instruction, which executes it and returns the next pre-decoded entry
+    struct Translation;
+    typedef const Translation* (*Step)(Machine& M, State& S);
+    struct Translation
+    {
+        Step _step;
+        uint8_t _IR, _D;
+        uint8_t _burst; // Length of the pixel burst starting here, zero when there isn't one
+        uint8_t _entry; // Entry flags, the fast paths that Cpu::run() tries in front of this instruction
+    };
+
+    // The vCPU dispatcher's st [y,x++] and the first instruction of a pixel burst
+    enum Entry {EntryNone=0x00, EntryVcpu=0x01, EntryBurst=0x02};
+    Step _steps[256];
+    Translation _translations[ROM_SIZE];
+    Translation* _translatedPages[ROM_SIZE/256] = {NULL};
 
     std::vector<uint8_t> _scanlinesRom0;
     std::vector<uint8_t> _scanlinesRom1;
 
     std::vector<InternalGt1> _internalGt1s;
 
+    bool _burstMode = BURST_MODE_DEFAULT;
+
 
-    uint8_t* getPtrToROM(int& romSize) {romSize = sizeof(_ROM); return (uint8_t*)_ROM;}
+    void invalidateTranslation(uint16_t address)
+    {
+        _translatedPages[(address & (ROM_SIZE-1)) >> 8] = NULL;
+#ifndef STAND_ALONE
+        Vcpu::invalidatePage(address);
+#endif
+    }
+
+    void invalidateTranslations(uint16_t address, int length)
+    {
+        for(int i=0; i<length; i+=256) invalidateTranslation(uint16_t(address + i));
+        if(length) invalidateTranslation(uint16_t(address + length - 1));
+    }
+
+    void invalidateTranslations(void)
+    {
+        for(int i=0; i<ROM_SIZE/256; i++) _translatedPages[i] = NULL;
+#ifndef STAND_ALONE
+        Vcpu::invalidatePages();
+#endif
+    }
+
+    // Caller may write to the ROM through this pointer, so any translations are discarded
+    uint8_t* getPtrToROM(int& romSize) {invalidateTranslations(); romSize = sizeof(_ROM); return (uint8_t*)_ROM;}
+    const uint8_t* getPtrToROM(void) {return (const uint8_t*)_ROM;}
 
     void initialiseInternalGt1s(void)
     {
@@ -83,6 +133,8 @@ namespace Cpu
 
         _ROM[0x00BB][ROM_INST] = 0x80;
         _ROM[0x00BB][ROM_DATA] = 0x00;
+
+        invalidateTranslation(0x00AD);
     }
 
     void patchScanlineModeVideoB(void)
@@ -122,6 +174,8 @@ namespace Cpu
 
         _ROM[0x01D3][ROM_INST] = 0x02;
         _ROM[0x01D3][ROM_DATA] = 0x00;
+
+        invalidateTranslation(0x01C2);
     }
 
     void patchScanlineModeVideoC(void)
@@ -140,6 +194,8 @@ namespace Cpu
 
         _ROM[0x01DE][ROM_INST] = 0x02;
         _ROM[0x01DE][ROM_DATA] = 0x00;
+
+        invalidateTranslation(0x01DA);
     }
 
     void patchTitleIntoRom(const std::string& title)
@@ -147,6 +203,7 @@ namespace Cpu
         int minLength = std::min(int(title.size()), MAX_TITLE_CHARS);
         for(int i=0; i<minLength; i++) _ROM[ROM_TITLE_ADDRESS + i][ROM_DATA] = title[i];
         for(int i=minLength; i<MAX_TITLE_CHARS; i++) _ROM[ROM_TITLE_ADDRESS + i][ROM_DATA] = ' ';
+        invalidateTranslations(ROM_TITLE_ADDRESS, MAX_TITLE_CHARS);
     }
 
     void patchSplitGt1IntoRom(const std::string& splitGt1path, const std::string& splitGt1name, uint16_t startAddress, InternalGt1Id gt1Id)
@@ -167,6 +224,7 @@ namespace Cpu
         romfile_td.read(filebuffer, filelength);
         if(romfile_td.eof() || romfile_td.bad() || romfile_td.fail()) fprintf(stderr, "Cpu::patchSplitGt1IntoRom() : failed to read %s ROM file.\n", std::string(splitGt1path + "_td").c_str());
         for(int i=0; i<filelength; i++) _ROM[startAddress + i][ROM_DATA] = filebuffer[i];
+        invalidateTranslations(startAddress, int(filelength));
 
         // Replace internal gt1 menu option with split gt1
         _ROM[_internalGt1s[gt1Id]._patch + 0][ROM_DATA] = startAddress & 0x00FF;
@@ -176,23 +234,34 @@ namespace Cpu
         int minLength = std::min(uint8_t(splitGt1name.size()), _internalGt1s[gt1Id]._length);
         for(int i=0; i<minLength; i++) _ROM[_internalGt1s[gt1Id]._string + i][ROM_DATA] = splitGt1name[i];
         for(int i=minLength; i<_internalGt1s[gt1Id]._length; i++) _ROM[_internalGt1s[gt1Id]._string + i][ROM_DATA] = ' ';
+
+        invalidateTranslations(_internalGt1s[gt1Id]._patch, 2);
+        invalidateTranslations(_internalGt1s[gt1Id]._string, _internalGt1s[gt1Id]._length);
     }
 
 
 #ifndef STAND_ALONE
-    int64_t getClock(void) {return _clock;}
-    uint8_t getIN(void) {return _IN;}
-    uint8_t getXOUT(void) {return _XOUT;}
-    uint8_t getRAM(uint16_t address) {return _RAM[address & (RAM_SIZE-1)];}
+    Machine& getMachine(void) {return *_machine;}
+    Machine& getMainMachine(void) {return _mainMachine;}
+    int64_t getClock(void) {return _machine->_clock;}
+    uint8_t getIN(void) {return _machine->_IN;}
+    uint8_t getXOUT(void) {return _machine->_XOUT;}
+    uint8_t getRAM(uint16_t address) {return _machine->_RAM[address & (RAM_SIZE-1)];}
+    uint8_t* getPtrToRAM(void) {return _machine->_RAM;}
+    const uint8_t* getDirtyPages(void) {return _machine->_dirtyPages;}
     uint8_t getROM(uint16_t address, int page) {return _ROM[address & (ROM_SIZE-1)][page & 0x01];}
-    uint16_t getRAM16(uint16_t address) {return _RAM[address & (RAM_SIZE-1)] | (_RAM[(address+1) & (RAM_SIZE-1)]<<8);}
+    uint16_t getRAM16(uint16_t address) {return _machine->_RAM[address & (RAM_SIZE-1)] | (_machine->_RAM[(address+1) & (RAM_SIZE-1)]<<8);}
     uint16_t getROM16(uint16_t address, int page) {return _ROM[address & (ROM_SIZE-1)][page & 0x01] | (_ROM[(address+1) & (ROM_SIZE-1)][page & 0x01]<<8);}
-    float getvCpuUtilisation(void) {return _vCpuUtilisation;}
+    float getvCpuUtilisation(void) {return _machine->_vCpuUtilisation;}
+    bool getBurstMode(void) {return _burstMode;}
 
 
-    void setClock(int64_t clock) {_clock = clock;}
-    void setIN(uint8_t in) {_IN = in;}
-    void setXOUT(uint8_t xout) {_XOUT = xout;}
+    // Only changes the calling thread's current machine, every thread starts out on the main machine
+    void setMachine(Machine& machine) {_machine = &machine;}
+    void setClock(int64_t clock) {_machine->_clock = clock;}
+    void setIN(uint8_t in) {_machine->_IN = in;}
+    void setXOUT(uint8_t xout) {_machine->_XOUT = xout;}
+    void setBurstMode(bool burstMode) {_burstMode = burstMode;}
 
     void setRAM(uint16_t address, uint8_t data)
     {
@@ -200,13 +269,15 @@ namespace Cpu
         if(address == 0x0000) return;
         if(address == 0x0080) return;
 
-        _RAM[address & (RAM_SIZE-1)] = data;
+        _machine->_RAM[address & (RAM_SIZE-1)] = data;
+        _machine->_dirtyPages[(address & (RAM_SIZE-1)) >> 8] = DIRTY_PAGE_ALL;
     }
 
     void setROM(uint16_t base, uint16_t address, uint8_t data)
     {
         uint16_t offset = (address - base) / 2;
         _ROM[base + offset][address & 0x01] = data;
+        invalidateTranslation(base + offset);
     }
 
     void setRAM16(uint16_t address, uint16_t data)
@@ -215,15 +286,20 @@ namespace Cpu
         if(address == 0x0000) return;
         if(address == 0x0080) return;
 
-        _RAM[address & (RAM_SIZE-1)] = uint8_t(data & 0x00FF);
-        _RAM[(address+1) & (RAM_SIZE-1)] = uint8_t((data & 0xFF00)>>8);
+        _machine->_RAM[address & (RAM_SIZE-1)] = uint8_t(data & 0x00FF);
+        _machine->_RAM[(address+1) & (RAM_SIZE-1)] = uint8_t((data & 0xFF00)>>8);
+        _machine->_dirtyPages[(address & (RAM_SIZE-1)) >> 8] = DIRTY_PAGE_ALL;
+        _machine->_dirtyPages[((address+1) & (RAM_SIZE-1)) >> 8] = DIRTY_PAGE_ALL;
     }
 
+    void clearDirtyPages(uint8_t flags) {for(int i=0; i<RAM_DIRTY_PAGES; i++) _machine->_dirtyPages[i] &= ~flags;}
+
     void setROM16(uint16_t base, uint16_t address, uint16_t data)
     {
         uint16_t offset = (address - base) / 2;
         _ROM[base + offset][address & 0x01] = uint8_t(data & 0x00FF);
         _ROM[base + offset][(address+1) & 0x01] = uint8_t((data & 0xFF00)>>8);
+        invalidateTranslation(base + offset);
     }
 
     void saveScanlineModes(void)
@@ -242,6 +318,8 @@ namespace Cpu
             _ROM[i][ROM_INST] = _scanlinesRom0[i - 0x01C2];
             _ROM[i][ROM_DATA] = _scanlinesRom1[i - 0x01C2];
         }
+
+        invalidateTranslation(0x01C2);
     }
 
     void setScanlineMode(ScanlineMode scanlineMode)
@@ -296,6 +374,293 @@ namespace Cpu
         {
             *dstRom++ = *srcRom++;
         } 
+
+        invalidateTranslations();
+    }
+
+    // Every opcode is a compile time specialisation of the ins/mod/bus decoder, so the per cycle decode collapses to a table lookup
+    template<uint8_t IR> void opcode(Machine& M, const State& S, State& T)
+    {
+        const int ins = IR >> 5;       // Instruction
+        const int mod = (IR >> 2) & 7; // Addressing mode (or condition)
+        const int bus = IR & 3;        // Busmode
+        const int W = (ins == 6);      // Write instruction?
+        const int J = (ins == 7);      // Jump instruction?
+
+        uint8_t lo=S._D, hi=0; // Mode Decoder
+        if(!J)
+        {
+            if(mod == 1  ||  mod == 3  ||  mod == 7) lo = S._X;
+            if(mod == 2  ||  mod == 3  ||  mod == 7) hi = S._Y;
+        }
+
+        uint16_t addr = (hi << 8) | lo;
+        uint8_t B = S._undef; // Data Bus
+        switch(bus)
+        {
+            case 0: B=S._D;                              break;
+            case 1: if (!W) B = M._RAM[addr&(RAM_SIZE-1)]; break;
+            case 2: B=S._AC;                               break;
+            case 3: B=M._IN;                               break;
+        }
+
+        if(W) // Random Access Memory
+        {
+            M._RAM[addr&(RAM_SIZE-1)] = B;
+            M._dirtyPages[(addr&(RAM_SIZE-1)) >> 8] = DIRTY_PAGE_ALL;
+        }
+
+        uint8_t ALU = 0; // Arithmetic and Logic Unit
+        switch(ins)
+        {
+            case 0: ALU =         B; break; // LD
+            case 1: ALU = S._AC & B; break; // ANDA
+            case 2: ALU = S._AC | B; break; // ORA
+            case 3: ALU = S._AC ^ B; break; // XORA
+            case 4: ALU = S._AC + B; break; // ADDA
+            case 5: ALU = S._AC - B; break; // SUBA
+            case 6: ALU = S._AC;     break; // ST
+            case 7: ALU = -S._AC;    break; // Bcc/JMP
+        }
+
+        // Load value into register, _AC and _OUT loading are disabled during _RAM write
+        if(!J)
+        {
+            switch(mod)
+            {
+                case 0: case 1: case 2: case 3: if(!W) T._AC = ALU;                       break;
+                case 4:                         T._X = ALU;                               break;
+                case 5:                         T._Y = ALU;                               break;
+                case 6:                         if(!W) T._OUT = ALU;                      break;
+                case 7:                         if(!W) T._OUT = ALU; T._X = S._X + 1;     break; // Increment _X
+            }
+        }
+
+        T._PC = S._PC + 1; // Next instruction
+        if(J)
+        {
+            if(mod != 0) // Conditional branch within page
+            {
+                int cond = (S._AC>>7) + 2*(S._AC==0);
+                if (mod & (1 << cond)) // 74153
+                T._PC = (S._PC & 0xff00) | B;
+            }
+            else
+            {
+                T._PC = (S._Y << 8) | B; // Unconditional far jump
+            }
+        }
+    }
+
+    Translation* translatePage(uint16_t address)
+    {
+        uint16_t page = (address & (ROM_SIZE-1)) & 0xFF00;
+        Translation* translation = &_translations[page];
+        for(int i=0; i<256; i++)
+        {
+            translation[i]._IR = _ROM[page + i][ROM_INST];
+            translation[i]._D  = _ROM[page + i][ROM_DATA];
+            translation[i]._step = _steps[translation[i]._IR];
+        }
+
+        // Pixel bursts, runs of the same ld/anda/ora/xora/adda/suba [Y,X++],OUT from RAM; the bus address only ever comes from X and Y,
+        // so D doesn't matter. Runs are cut at the end of the page, so a ROM patch can only ever change the bursts of its own page
+        int length = 0;
+        for(int i=255; i>=0; i--)
+        {
+            uint8_t IR = translation[i]._IR;
+            bool pixel = (IR & 0x1F) == 0x1D  &&  (IR >> 5) < 6;
+            length = !pixel ? 0 : (i < 255  &&  translation[i + 1]._IR == IR) ? std::min(length + 1, BURST_MAX) : 1;
+            translation[i]._burst = (length >= BURST_MIN) ? uint8_t(length) : 0;
+            translation[i]._entry = (translation[i]._burst) ? EntryBurst : EntryNone;
+        }
+        if(page == ((ROM_VCPU_DISPATCH-1) & 0xFF00)) translation[(ROM_VCPU_DISPATCH-1) & 0xFF]._entry |= EntryVcpu;
+
+        _translatedPages[page >> 8] = translation;
+        return translation;
+    }
+
+    // Translates every ROM page up front, machines running on other threads must never translate lazily as the cache is shared
+    void translateRom(void)
+    {
+        for(int i=0; i<ROM_SIZE/256; i++)
+        {
+            if(_translatedPages[i] == NULL) translatePage(uint16_t(i << 8));
+        }
+#ifndef STAND_ALONE
+        Vcpu::checkRom();
+#endif
+    }
+
+    // Threaded version of an opcode, fetch comes from the translation cache so the next instruction arrives already decoded
+    template<uint8_t IR> const Translation* step(Machine& M, State& S)
+    {
+        const Translation* page = _translatedPages[S._PC >> 8];
+        if(page == NULL) page = translatePage(S._PC);
+        const Translation* fetch = &page[S._PC & 0xFF];
+
+        State T = S; // New state is old state unless something changes
+        T._IR = fetch->_IR;
+        T._D  = fetch->_D;
+        opcode<IR>(M, S, T);
+        S = T;
+
+        return fetch;
+    }
+
+    template<int N> struct OpcodeTable
+    {
+        static void initialise(void) {OpcodeTable<N-1>::initialise(); _opcodes[N-1] = opcode<N-1>; _steps[N-1] = step<N-1>;}
+    };
+    template<> struct OpcodeTable<0>
+    {
+        static void initialise(void) {}
+    };
+
+    void initialiseOpcodes(void)
+    {
+        OpcodeTable<256>::initialise();
+    }
+
+    // Original three switch decoder, kept as the "before" half of the benchmark
+    State cycleDecoded(const State& S)
+    {
+        State T = S; // New state is old state unless something changes
+    
+        T._IR = _ROM[S._PC][ROM_INST]; // Instruction Fetch
+        T._D  = _ROM[S._PC][ROM_DATA];
+    
+        int ins = S._IR >> 5;       // Instruction
+        int mod = (S._IR >> 2) & 7; // Addressing mode (or condition)
+        int bus = S._IR&3;          // Busmode
+        int W = (ins == 6);        // Write instruction?
+        int J = (ins == 7);        // Jump instruction?
+    
+        uint8_t lo=S._D, hi=0, *to=NULL; // Mode Decoder
+        int incX=0;
+        if(!J)
+        {
+            switch (mod)
+            {
+                #define E(p) (W?0:p) // Disable _AC and _OUT loading during _RAM write
+                case 0: to=E(&T._AC);                            break;
+                case 1: to=E(&T._AC); lo=S._X;                   break;
+                case 2: to=E(&T._AC);         hi=S._Y;           break;
+                case 3: to=E(&T._AC); lo=S._X; hi=S._Y;          break;
+                case 4: to=  &T._X;                              break;
+                case 5: to=  &T._Y;                              break;
+                case 6: to=E(&T._OUT);                           break;
+                case 7: to=E(&T._OUT); lo=S._X; hi=S._Y; incX=1; break;
+                #undef E
+            }
+        }
+
+        uint16_t addr = (hi << 8) | lo;
+        int B = S._undef; // Data Bus
+        switch(bus)
+        {
+            case 0: B=S._D;                              break;
+            case 1: if (!W) B = _machine->_RAM[addr&(RAM_SIZE-1)]; break;
+            case 2: B=S._AC;                                       break;
+            case 3: B=_machine->_IN;                               break;
+        }
+
+        if(W) // Random Access Memory
+        {
+            _machine->_RAM[addr&(RAM_SIZE-1)] = B;
+            _machine->_dirtyPages[(addr&(RAM_SIZE-1)) >> 8] = DIRTY_PAGE_ALL;
+        }
+
+        uint8_t ALU; // Arithmetic and Logic Unit
+        switch(ins)
+        {
+            case 0: ALU =        B; break; // LD
+            case 1: ALU = S._AC & B; break; // ANDA
+            case 2: ALU = S._AC | B; break; // ORA
+            case 3: ALU = S._AC ^ B; break; // XORA
+            case 4: ALU = S._AC + B; break; // ADDA
+            case 5: ALU = S._AC - B; break; // SUBA
+            case 6: ALU = S._AC;     break; // ST
+            case 7: ALU = -S._AC;    break; // Bcc/JMP
+        }
+
+        if(to) *to = ALU; // Load value into register
+        if(incX) T._X = S._X + 1; // Increment _X
+
+        T._PC = S._PC + 1; // Next instruction
+        if(J)
+        {
+            if(mod != 0) // Conditional branch within page
+            {
+                int cond = (S._AC>>7) + 2*(S._AC==0);
+                if (mod & (1 << cond)) // 74153
+                T._PC = (S._PC & 0xff00) | B;
+            }
+            else
+            {
+                T._PC = (S._Y << 8) | B; // Unconditional far jump
+            }
+        }
+
+        return T;
+    }
+
+    // Runs the ROM from power on with the switch decoder, the opcode table and the translation cache and reports cycles per second,
+    // RAM and State must end up identical, (gtemu-headless -benchmark)
+    void benchmark(int64_t cycles)
+    {
+        static uint8_t ram[RAM_SIZE];
+        uint8_t* RAM = _machine->_RAM;
+        memcpy(ram, RAM, RAM_SIZE);
+
+        const int passes = 3;
+        double mcps[passes];
+        State results[passes];
+        uint8_t* rams[passes] = {new uint8_t[RAM_SIZE], new uint8_t[RAM_SIZE], new uint8_t[RAM_SIZE]};
+        for(int pass=0; pass<passes; pass++)
+        {
+            State S;
+            memset(&S, 0, sizeof(S));
+            memcpy(RAM, ram, RAM_SIZE);
+
+            auto start = std::chrono::steady_clock::now();
+            switch(pass)
+            {
+                case 0: for(int64_t i=0; i<cycles; i++) S = cycleDecoded(S); break;
+                case 1: for(int64_t i=0; i<cycles; i++) S = cycle(S);        break;
+                case 2: execute(S, cycles);                                  break;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            mcps[pass] = (seconds > 0.0) ? double(cycles) / seconds / 1.0e6 : 0.0;
+            results[pass] = S;
+            memcpy(rams[pass], RAM, RAM_SIZE);
+        }
+
+        bool identical = true;
+        for(int pass=1; pass<passes; pass++)
+        {
+            if(memcmp(&results[0], &results[pass], sizeof(State))  ||  memcmp(rams[0], rams[pass], RAM_SIZE)) identical = false;
+        }
+        fprintf(stderr, "Cpu::benchmark() : %" PRId64 " cycles : switch decoder %.2f Mcycles/s : opcode table %.2f Mcycles/s : translation cache %.2f Mcycles/s : results %s\n",
+                        cycles, mcps[0], mcps[1], mcps[2], identical ? "identical" : "DIFFER");
+
+        for(int pass=0; pass<passes; pass++) delete [] rams[pass];
+        memcpy(RAM, ram, RAM_SIZE);
+    }
+
+    // Power on state of a machine, RAM and registers are random and the clock is held in reset
+    void initialise(Machine& M)
+    {
+        garble(M._RAM, sizeof M._RAM);
+        memset(M._dirtyPages, DIRTY_PAGE_ALL, sizeof M._dirtyPages);
+        garble((uint8_t*)&M._state, sizeof M._state);
+        M._clock = CLOCK_RESET;
+        M._IN = 0xFF;
+        M._XOUT = 0x00;
+        M._vCpuInstPerFrame = 0;
+        M._vCpuInstPerFrameMax = 0;
+        M._vCpuUtilisation = 0.0f;
     }
 
     void initialise(State& S)
@@ -320,7 +685,7 @@ namespace Cpu
         // Memory
         srand((unsigned int)time(NULL)); // Initialize with randomized data
         garble((uint8_t*)_ROM, sizeof _ROM);
-        garble(_RAM, sizeof _RAM);
+        initialise(_mainMachine);
         garble((uint8_t*)&S, sizeof S);
 
         // Check for ROM file
@@ -334,6 +699,7 @@ namespace Cpu
         {
             // Load ROM file
             romfile.read((char *)_ROM, sizeof(_ROM));
+            invalidateTranslations();
             if(romfile.bad() || romfile.fail())
             {
                 fprintf(stderr, "Cpu::initialise() : failed to read %s ROM file, using default ROM.\n", filenameRom.c_str());
@@ -346,6 +712,9 @@ namespace Cpu
         }
         saveScanlineModes();
 
+        // Opcode dispatch table
+        initialiseOpcodes();
+
 //#define CUSTOM_ROM
 #ifdef CUSTOM_ROM
         initialiseInternalGt1s();
@@ -366,12 +735,14 @@ namespace Cpu
 #endif
 #endif
 
+#ifndef HEADLESS
         // SDL initialisation
         if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_EVENTS) < 0)
         {
             fprintf(stderr, "Cpu::initialise() : failed to initialise SDL.\n");
             _EXIT_(EXIT_FAILURE);
         }
+#endif
     }
 
     State cycle(const State& S)
@@ -380,75 +751,192 @@ namespace Cpu
     
         T._IR = _ROM[S._PC][ROM_INST]; // Instruction Fetch
         T._D  = _ROM[S._PC][ROM_DATA];
+
+        _opcodes[S._IR](*_machine, S, T);
+
+        return T;
+    }
+
+    State cycle(Machine& M, const State& S)
+    {
+        State T = S; // New state is old state unless something changes
     
-        int ins = S._IR >> 5;       // Instruction
-        int mod = (S._IR >> 2) & 7; // Addressing mode (or condition)
-        int bus = S._IR&3;          // Busmode
-        int W = (ins == 6);        // Write instruction?
-        int J = (ins == 7);        // Jump instruction?
-    
-        uint8_t lo=S._D, hi=0, *to=NULL; // Mode Decoder
-        int incX=0;
-        if(!J)
+        T._IR = _ROM[S._PC][ROM_INST]; // Instruction Fetch
+        T._D  = _ROM[S._PC][ROM_DATA];
+
+        _opcodes[S._IR](M, S, T);
+
+        return T;
+    }
+
+    // Threaded version of cycle(), equivalent to calling cycle() repeatedly but fetch and decode are replaced by the translation cache;
+    // branch targets are left to the opcodes, the Gigatron branches within the page of PC, which is not the page of the branch at 0xXXFF or in a delay slot
+    void execute(State& S, int64_t cycles)
+    {
+        Machine& M = *_machine;
+        State R = S;
+        Step step = _steps[R._IR];
+        for(int64_t i=0; i<cycles; i++)
         {
-            switch (mod)
-            {
-                #define E(p) (W?0:p) // Disable _AC and _OUT loading during _RAM write
-                case 0: to=E(&T._AC);                            break;
-                case 1: to=E(&T._AC); lo=S._X;                   break;
-                case 2: to=E(&T._AC);         hi=S._Y;           break;
-                case 3: to=E(&T._AC); lo=S._X; hi=S._Y;          break;
-                case 4: to=  &T._X;                              break;
-                case 5: to=  &T._Y;                              break;
-                case 6: to=E(&T._OUT);                           break;
-                case 7: to=E(&T._OUT); lo=S._X; hi=S._Y; incX=1; break;
-            }
+            step = step(M, R)->_step;
         }
+        S = R;
+    }
 
-        uint16_t addr = (hi << 8) | lo;
-        int B = S._undef; // Data Bus
-        switch(bus)
+    // Executes a whole pixel burst when S is about to execute the first instruction of one, (see translatePage()), and there is enough
+    // budget for it; a burst that would change the sync bits part way through is left to be executed a cycle at a time
+    int64_t pixelBurst(Machine& M, State& S, int64_t cycles, EventSink& sink)
+    {
+        uint16_t address = S._PC - 1;
+        const Translation* page = _translatedPages[address >> 8];
+        if(page == NULL) page = translatePage(address);
+        const Translation& start = page[address & 0xFF];
+        int length = start._burst;
+        if(length == 0  ||  length > cycles  ||  start._IR != S._IR) return 0;
+
+        // The page of RAM never changes, X wraps within it
+        const uint8_t* ram = &M._RAM[(S._Y << 8) & (RAM_SIZE-1)];
+        int ins = S._IR >> 5;
+        uint8_t out = S._OUT, x = S._X;
+        for(int i=0; i<length; i++, x++)
         {
-            case 0: B=S._D;                              break;
-            case 1: if (!W) B = _RAM[addr&(RAM_SIZE-1)]; break;
-            case 2: B=S._AC;                             break;
-            case 3: B=_IN;                               break;
+            uint8_t ALU = 0;
+            switch(ins)
+            {
+                case 0: ALU =         ram[x]; break; // LD
+                case 1: ALU = S._AC & ram[x]; break; // ANDA
+                case 2: ALU = S._AC | ram[x]; break; // ORA
+                case 3: ALU = S._AC ^ ram[x]; break; // XORA
+                case 4: ALU = S._AC + ram[x]; break; // ADDA
+                case 5: ALU = S._AC - ram[x]; break; // SUBA
+            }
+            if((ALU ^ out) & 0xC0) return 0;
+
+            sink._burst[i] = out;
+            out = ALU;
         }
 
-        if(W) _RAM[addr&(RAM_SIZE-1)] = B; // Random Access Memory
+        // AC is untouched, (OUT is the destination), and fetch carries on straight after the burst
+        uint16_t next = address + length;
+        S._OUT = out;
+        S._X = x;
+        S._IR = _ROM[next][ROM_INST];
+        S._D  = _ROM[next][ROM_DATA];
+        S._PC = next + 1;
+        sink._burstLength = length;
 
-        uint8_t ALU; // Arithmetic and Logic Unit
-        switch(ins)
-        {
-            case 0: ALU =        B; break; // LD
-            case 1: ALU = S._AC & B; break; // ANDA
-            case 2: ALU = S._AC | B; break; // ORA
-            case 3: ALU = S._AC ^ B; break; // XORA
-            case 4: ALU = S._AC + B; break; // ADDA
-            case 5: ALU = S._AC - B; break; // SUBA
-            case 6: ALU = S._AC;     break; // ST
-            case 7: ALU = -S._AC;    break; // Bcc/JMP
-        }
+        return length;
+    }
 
-        if(to) *to = ALU; // Load value into register
-        if(incX) T._X = S._X + 1; // Increment _X
+    // Runs until one of the sink's subscribed events or the end of the budget, returns the number of cycles executed and advances the clock;
+    // events are checked between instructions, so EventIn stops in front of the instruction that reads IN and EventBreakpoint when PC reaches
+    // a breakpoint, the first instruction of a run is always executed. Everything else is a tight loop through the translation cache; the vCPU
+    // fast path is only used while no breakpoints are set and never changes OUT except on its last cycle
+    int64_t run(State& S, int64_t maxCycles, EventSink& sink)
+    {
+        return run(*_machine, S, maxCycles, sink);
+    }
 
-        T._PC = S._PC + 1; // Next instruction
-        if(J)
+    // vCPU utilisation is single instance and belongs to the main machine, any other machine runs through the translation cache and the
+    // vCPU fast path, which makes it safe to run on its own thread once translateRom() has been called
+    int64_t run(Machine& M, State& S, int64_t maxCycles, EventSink& sink)
+    {
+        bool main = (&M == &_mainMachine)  &&  (_machine == &_mainMachine);
+        bool vcpu = sink._breakpoints.empty()  &&  Vcpu::getMode() != VCPU_MODE_OFF;
+        bool burst = (sink._events & EventBurst)  &&  sink._breakpoints.empty();
+
+        // Fast paths are only tried in front of an instruction whose translation is marked as an entry to one, and at the start of a run or
+        // straight after another fast path, where it isn't known which instruction S holds; IN reads and breakpoints are checked after
+        // every instruction only while they are subscribed
+        uint8_t entries = ((main  ||  vcpu) ? EntryVcpu : EntryNone) | (burst ? EntryBurst : EntryNone);
+        bool checkEach = (sink._events & EventIn)  ||  !sink._breakpoints.empty();
+
+        State R = S;
+        Step step = _steps[R._IR];
+        uint8_t entry = entries;
+        uint8_t out = R._OUT;
+        int64_t executed = 0;
+        sink._event = EventNone;
+        while(sink._event == EventNone)
         {
-            if(mod != 0) // Conditional branch within page
+            if(executed >= maxCycles)
             {
-                int cond = (S._AC>>7) + 2*(S._AC==0);
-                if (mod & (1 << cond)) // 74153
-                T._PC = (S._PC & 0xff00) | B;
+                sink._event = EventBudget;
+                break;
+            }
+
+            int64_t cycles = 0;
+            if(entry)
+            {
+                // vCPU instruction slot utilisation
+                if((entry & EntryVcpu)  &&  R._PC == ROM_VCPU_DISPATCH)
+                {
+                    if(main) vCpuUsage(R);
+                    if(vcpu) cycles = Vcpu::execute(M, R, maxCycles - executed);
+                }
+                if((entry & EntryBurst)  &&  cycles == 0  &&  (R._IR & 0x1F) == 0x1D)
+                {
+                    cycles = pixelBurst(M, R, maxCycles - executed, sink);
+                    if(cycles) sink._event |= EventBurst;
+                }
+            }
+
+            if(cycles)
+            {
+                step = _steps[R._IR];
+                entry = entries;
+                executed += cycles;
             }
             else
             {
-                T._PC = (S._Y << 8) | B; // Unconditional far jump
+                // Threaded interpreter, until OUT changes, the budget is spent or the next instruction is an entry
+                const Translation* fetch;
+                do
+                {
+                    fetch = step(M, R);
+                    step = fetch->_step;
+                    executed++;
+                }
+                while(R._OUT == out  &&  executed < maxCycles  &&  !(fetch->_entry & entries)  &&  !checkEach);
+                entry = fetch->_entry & entries;
+            }
+
+            if(R._OUT != out)
+            {
+                if(sink._events & EventOut) sink._event |= EventOut;
+                if((sink._events & EventHSync)  &&  (R._OUT & 0x40) > (out & 0x40)) sink._event |= EventHSync;
+                if((sink._events & EventVSync)  &&  (R._OUT & 0x80) < (out & 0x80)) sink._event |= EventVSync;
+                out = R._OUT;
+            }
+            if(checkEach)
+            {
+                if((sink._events & EventIn)  &&  (R._IR & 0x03) == 0x03) sink._event |= EventIn;
+                if(std::find(sink._breakpoints.begin(), sink._breakpoints.end(), R._PC) != sink._breakpoints.end()) sink._event |= EventBreakpoint;
             }
         }
 
-        return T;
+        S = R;
+        M._clock += executed;
+
+        return executed;
+    }
+
+    // Everything main() does for the main machine that is part of the board rather than the display, power on reset and latching XOUT on
+    // the rising edge of hSync; _undef is left alone so that a machine's run only depends on its RAM, state and IN
+    void runMachine(Machine& M, int64_t cycles)
+    {
+        EventSink sink;
+        sink._events = EventHSync | (_burstMode ? EventBurst : 0);
+
+        State& S = M._state;
+        while(cycles > 0)
+        {
+            // MCP100 Power-On Reset
+            if(M._clock < 0) S._PC = 0;
+
+            cycles -= run(M, S, (M._clock < 0) ? 1 : cycles, sink);
+            if(sink._event & EventHSync) M._XOUT = S._AC;
+        }
     }
 
     void reset(bool coldBoot)
@@ -460,19 +948,22 @@ namespace Cpu
             setRAM(BOOT_CHECK, 0xA6); // TODO: don't hardcode the checksum, calculate it properly
         }
 
+#ifndef HEADLESS
         Graphics::resetVTable();
         Editor::setSingleStepWatchAddress(VIDEO_Y_ADDRESS);
+#endif
         setClock(CLOCK_RESET);
     }
 
-    // Counts maximum and used vCPU instruction slots available per frame
+    // Counts maximum and used vCPU instruction slots available per frame, headless builds have no Editor or wall clock to measure against
     void vCpuUsage(State& S)
     {
+#ifndef HEADLESS
         if(S._PC == ROM_VCPU_DISPATCH)
         {
             uint16_t vPC = (getRAM(0x0017) <<8) |getRAM(0x0016);
-            if(vPC < Editor::getCpuUsageAddressA()  ||  vPC > Editor::getCpuUsageAddressB()) _vCpuInstPerFrame++;
-            _vCpuInstPerFrameMax++;
+            if(vPC < Editor::getCpuUsageAddressA()  ||  vPC > Editor::getCpuUsageAddressB()) _machine->_vCpuInstPerFrame++;
+            _machine->_vCpuInstPerFrameMax++;
 
             static uint64_t prevFrameCounter = 0;
             double frameTime = double(SDL_GetPerformanceCounter() - prevFrameCounter) / double(SDL_GetPerformanceFrequency());
@@ -491,11 +982,15 @@ namespace Cpu
                 }
 
                 prevFrameCounter = SDL_GetPerformanceCounter();
-                _vCpuUtilisation = (_vCpuInstPerFrameMax) ? float(_vCpuInstPerFrame) / float(_vCpuInstPerFrameMax) : 0.0f;
-                _vCpuInstPerFrame = 0;
-                _vCpuInstPerFrameMax = 0;
+                Machine& M = *_machine;
+                M._vCpuUtilisation = (M._vCpuInstPerFrameMax) ? float(M._vCpuInstPerFrame) / float(M._vCpuInstPerFrameMax) : 0.0f;
+                M._vCpuInstPerFrame = 0;
+                M._vCpuInstPerFrameMax = 0;
             }
         }
+#else
+        (void)S;
+#endif
     }
 #endif
 }
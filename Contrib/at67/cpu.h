@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <string>
+#include <vector>
+
+#include "memory.h"
+#include "timing.h"
 
 
 #define MAJOR_VERSION "0.7"
@@ -21,6 +25,19 @@
 
 #define ROM_VCPU_DISPATCH 0x0309
 
+#define RAM_DIRTY_PAGES (RAM_SIZE/256)
+
+// Each tracker of dirty pages owns a bit, stores set every bit and a tracker only ever clears its own
+#define DIRTY_PAGE_REWIND 0x01
+#define DIRTY_PAGE_VIDEO  0x02
+#define DIRTY_PAGE_ALL    0xFF
+
+// Pixel bursts, the ROM's runs of identical ld/ora/etc [Y,X++],OUT instructions, are executed as one step by runs that subscribe to
+// EventBurst, (set BURST_MODE_DEFAULT or Cpu::setBurstMode()); bit exact, only runs of at least BURST_MIN within one ROM page qualify
+#define BURST_MODE_DEFAULT  false
+#define BURST_MIN           16
+#define BURST_MAX           255
+
 #if defined(_WIN32)
 #define _EXIT_(f)   \
     system("pause");\
@@ -48,6 +65,35 @@ namespace Cpu
         uint8_t _IR, _D, _AC, _X, _Y, _OUT, _undef;
     };
 
+    // Events Cpu::run() can stop on, _events is the subscription mask and _event is what actually stopped the last run; a run stops with
+    // EventBurst straight after a pixel burst, which took the last _burstLength cycles of it, _burst is the OUT seen during each of those
+    // cycles, (the OUT from before the burst followed by every pixel but the last, which is OUT at the end of the run)
+    enum Event {EventNone=0x00, EventOut=0x01, EventHSync=0x02, EventVSync=0x04, EventIn=0x08, EventBreakpoint=0x10, EventBudget=0x20, EventBurst=0x40};
+    struct EventSink
+    {
+        uint32_t _events = EventHSync | EventVSync;
+        uint32_t _event = EventNone;
+        std::vector<uint16_t> _breakpoints;
+        int _burstLength = 0;
+        uint8_t _burst[BURST_MAX];
+    };
+
+    // One emulated Gigatron, everything except the ROM, which is shared read only by every machine in the process; the accessors below
+    // work on the calling thread's current machine, which is the main machine driven by main() unless setMachine() says otherwise
+    struct Machine
+    {
+        State _state;
+        int64_t _clock = CLOCK_RESET;
+        uint8_t _IN = 0xFF, _XOUT = 0x00;
+        int _vCpuInstPerFrame = 0;
+        int _vCpuInstPerFrameMax = 0;
+        float _vCpuUtilisation = 0.0f;
+
+        // One byte of DIRTY_PAGE_ flags per 256 byte page of RAM, set by every store and cleared by whoever is tracking them, (e.g. Rewind)
+        uint8_t _dirtyPages[RAM_DIRTY_PAGES];
+        uint8_t _RAM[RAM_SIZE];
+    };
+
     struct InternalGt1
     {
         uint16_t _start;
@@ -58,6 +104,10 @@ namespace Cpu
 
 
     uint8_t* getPtrToROM(int& romSize);
+    const uint8_t* getPtrToROM(void);
+
+    void invalidateTranslation(uint16_t address);
+    void invalidateTranslations(void);
 
     void setFreeRAM(uint16_t freeRAM);
 
@@ -69,27 +119,43 @@ namespace Cpu
     void patchTitleIntoRom(const std::string& title);
     void patchSplitGt1IntoRom(const std::string& splitGt1path, const std::string& splitGt1name, uint16_t startAddress, InternalGt1Id gt1Id);
 
-#ifndef STAND_ALONE
+#if !defined(STAND_ALONE)  ||  defined(HEADLESS)
+    Machine& getMachine(void);
+    Machine& getMainMachine(void);
     int64_t getClock(void);
     uint8_t getIN(void);
     uint8_t getXOUT(void);
     uint8_t getRAM(uint16_t address);
+    uint8_t* getPtrToRAM(void);
+    const uint8_t* getDirtyPages(void);
     uint8_t getROM(uint16_t address, int page);
     uint16_t getRAM16(uint16_t address);
     uint16_t getROM16(uint16_t address, int page);
     float getvCpuUtilisation(void);
+    bool getBurstMode(void);
 
+    void setMachine(Machine& machine);
     void setClock(int64_t clock);
     void setIN(uint8_t in);
     void setXOUT(uint8_t xout);
     void setRAM(uint16_t address, uint8_t data);
     void setROM(uint16_t base, uint16_t address, uint8_t data);
     void setRAM16(uint16_t address, uint16_t data);
+    void clearDirtyPages(uint8_t flags);
     void setROM16(uint16_t base, uint16_t address, uint16_t data);
     void setScanlineMode(ScanlineMode scanlineMode);
+    void setBurstMode(bool burstMode);
 
     void initialise(State& S);
+    void initialise(Machine& M);
+    void translateRom(void);
     State cycle(const State& S);
+    State cycle(Machine& M, const State& S);
+    void execute(State& S, int64_t cycles);
+    void benchmark(int64_t cycles);
+    int64_t run(State& S, int64_t maxCycles, EventSink& sink);
+    int64_t run(Machine& M, State& S, int64_t maxCycles, EventSink& sink);
+    void runMachine(Machine& M, int64_t cycles);
     void reset(bool coldBoot=false);
     void vCpuUsage(State& S);
 #endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <sys/stat.h>
 
 
@@ -22,10 +23,15 @@
 #include "audio.h"
 #include "editor.h"
 #include "loader.h"
+#include "snapshot.h"
+#include "capture.h"
+#include "analyser.h"
+#include "rewind.h"
 #include "timing.h"
 #include "graphics.h"
 #include "assembler.h"
 #include "expression.h"
+#include "spsc.h"
 #include "inih/INIReader.h"
 
 
@@ -37,17 +43,29 @@ namespace Editor
         std::string _name;
     };
 
+    struct InputEvent
+    {
+        SDL_Event _event;
+        uint64_t _frame;
+    };
+
 
     int _cursorX = 0;
     int _cursorY = 0;
 
     bool _hexEdit = false;
-    bool _startMusic = false;
     bool _ps2KeyboardDown = false;
 
     SDL_Keycode _sdlKeyCode = 0;
     uint16_t _sdlKeyModifier = 0;
 
+    // Input from the SDL thread, latency is how many frames the emulation had moved on by the time the last event was handled
+    Spsc::Queue<InputEvent, INPUT_EVENT_QUEUE> _inputEvents;
+    uint64_t _inputLatency = 0;
+
+    // Set by the SDL thread once the window is closed, the emulation thread finishes its frame and returns
+    std::atomic<bool> _quitting{false};
+
     bool _singleStep = false;
     bool _singleStepMode = false;
     uint32_t _singleStepTicks = 0;
@@ -80,9 +98,9 @@ namespace Editor
     int getCursorX(void) {return _cursorX;}
     int getCursorY(void) {return _cursorY;}
     bool getHexEdit(void) {return _hexEdit;}
-    bool getStartMusic(void) {return _startMusic;}
     bool getSingleStep(void) {return _singleStep;}
     bool getSingleStepMode(void) {return _singleStepMode;}
+    bool getQuitting(void) {return _quitting.load(std::memory_order_relaxed);}
     MemoryMode getMemoryMode(void) {return _memoryMode;}
     EditorMode getEditorMode(void) {return _editorMode;}
     uint8_t getMemoryDigit(void) {return _memoryDigit;}
@@ -105,10 +123,10 @@ namespace Editor
         if(removeSlash  &&  str.length()) str.erase(str.length()-1);
         return str;
     }
+    uint64_t getInputLatency(void) {return _inputLatency;}
 
     void setCursorX(int x) {_cursorX = x;}
     void setCursorY(int y) {_cursorY = y;}
-    void setStartMusic(bool startMusic) {_startMusic = startMusic;}
     void setSingleStep(bool singleStep) {_singleStep = singleStep;}
     void setSingleStepMode(bool singleStepMode) {_singleStepMode = singleStepMode;}
     void setLoadBaseAddress(uint16_t address) {_loadBaseAddress = address;}
@@ -283,6 +301,11 @@ namespace Editor
         _inputKeys["Quit"]         = SDLK_ESCAPE;
         _inputKeys["Reset"]        = SDLK_F1;
         _inputKeys["ScanlineMode"] = SDLK_F3;
+        _inputKeys["SaveState"]    = SDLK_F2;
+        _inputKeys["LoadState"]    = SDLK_F4;
+        _inputKeys["Capture"]      = SDLK_v;
+        _inputKeys["Timing"]       = SDLK_t;
+        _inputKeys["Music"]        = SDLK_F8;
         _inputKeys["Speed+"]       = SDLK_EQUALS;
         _inputKeys["Speed-"]       = SDLK_MINUS;
         _inputKeys["Giga_Left"]    = SDLK_a;
@@ -295,6 +318,9 @@ namespace Editor
         _inputKeys["Giga_B"]       = SDLK_SLASH;
         _inputKeys["Debug"]        = SDLK_F6;
         _inputKeys["Step"]         = SDLK_F7;
+        _inputKeys["Rewind"]       = SDLK_BACKSPACE;
+        _inputKeys["Scrub-"]       = SDLK_LEFTBRACKET;
+        _inputKeys["Scrub+"]       = SDLK_RIGHTBRACKET;
         _inputKeys["Hex_Mode"]     = SDLK_F9;
         _inputKeys["PS2_KB"]       = SDLK_F10;
         _inputKeys["Giga"]         = SDLK_F11;
@@ -354,6 +380,11 @@ namespace Editor
                     scanCodeFromIniKey(sectionString, "Quit",         "ESCAPE", _inputKeys["Quit"]);
                     scanCodeFromIniKey(sectionString, "Reset",        "F1",     _inputKeys["Reset"]);
                     scanCodeFromIniKey(sectionString, "ScanlineMode", "F3",     _inputKeys["ScanlineMode"]);
+                    scanCodeFromIniKey(sectionString, "SaveState",    "F2",     _inputKeys["SaveState"]);
+                    scanCodeFromIniKey(sectionString, "LoadState",    "F4",     _inputKeys["LoadState"]);
+                    scanCodeFromIniKey(sectionString, "Capture",      "V",      _inputKeys["Capture"]);
+                    scanCodeFromIniKey(sectionString, "Timing",       "T",      _inputKeys["Timing"]);
+                    scanCodeFromIniKey(sectionString, "Music",        "F8",     _inputKeys["Music"]);
                     scanCodeFromIniKey(sectionString, "Speed+",       "+",      _inputKeys["Speed+"]);
                     scanCodeFromIniKey(sectionString, "Speed-",       "-",      _inputKeys["Speed-"]);
                     scanCodeFromIniKey(sectionString, "PS2_KB",       "F10",    _inputKeys["PS2_KB"]);
@@ -379,6 +410,9 @@ namespace Editor
                 {
                     scanCodeFromIniKey(sectionString, "Debug", "F6", _inputKeys["Debug"]);
                     scanCodeFromIniKey(sectionString, "Step",  "F7", _inputKeys["Step"]);
+                    scanCodeFromIniKey(sectionString, "Rewind", "BACKSPACE", _inputKeys["Rewind"]);
+                    scanCodeFromIniKey(sectionString, "Scrub-", "[",         _inputKeys["Scrub-"]);
+                    scanCodeFromIniKey(sectionString, "Scrub+", "]",         _inputKeys["Scrub+"]);
                 }
                 break;
             }
@@ -692,20 +726,19 @@ namespace Editor
 
         else if(_sdlKeyCode == _inputKeys["Speed+"])
         {
-            double timingHack = Timing::getTimingHack() - VSYNC_TIMING_60*0.05;
+            double timingHack = Timing::getTimingHack() - VSYNC_TIMING_GIGA*0.05;
             if(timingHack >= 0.0) Timing::setTimingHack(timingHack);
         }
 
         else if(_sdlKeyCode == _inputKeys["Speed-"])
         {
-            double timingHack = Timing::getTimingHack() + VSYNC_TIMING_60*0.05;
-            if(timingHack <= VSYNC_TIMING_60) Timing::setTimingHack(timingHack);
+            double timingHack = Timing::getTimingHack() + VSYNC_TIMING_GIGA*0.05;
+            if(timingHack <= VSYNC_TIMING_GIGA*1.0001) Timing::setTimingHack(std::min(timingHack, VSYNC_TIMING_GIGA));
         }
 
         else if(_sdlKeyCode == _inputKeys["Quit"])
         {
-            SDL_Quit();
-            exit(0);
+            quit();
         }
 
         // Fast reset
@@ -716,6 +749,35 @@ namespace Editor
                 (_sdlKeyModifier & KMOD_CTRL) ? Loader::sendCommandToGiga('R', false) : Cpu::reset();
             }
         }
+
+        // Save states, serviced by main() on the next vSync
+        else if(_sdlKeyCode == _inputKeys["SaveState"])
+        {
+            Snapshot::setRequest(Snapshot::Save);
+        }
+
+        else if(_sdlKeyCode == _inputKeys["LoadState"])
+        {
+            Snapshot::setRequest(Snapshot::Load);
+        }
+
+        // Lossless video capture, written on its own thread
+        else if(_sdlKeyCode == _inputKeys["Capture"])
+        {
+            Capture::getCapturing() ? Capture::stop() : (void)Capture::start(CAPTURE_FILE);
+        }
+
+        // Video timing analysis, the report is written when it stops
+        else if(_sdlKeyCode == _inputKeys["Timing"])
+        {
+            Analyser::getAnalysing() ? Analyser::stop(ANALYSER_FILE) : Analyser::start();
+        }
+
+        // Music sequencer, CTRL skips to the next queued score
+        else if(_sdlKeyCode == _inputKeys["Music"])
+        {
+            (_sdlKeyModifier & KMOD_CTRL) ? Audio::nextScore() : Audio::setMusicPlaying(!Audio::getMusicPlaying());
+        }
     }
 
     // PS2 Keyboard emulation mode
@@ -886,7 +948,13 @@ namespace Editor
                 FileType fileType = getCurrentFileEntryType();
                 switch(fileType)
                 {
-                    case File: (_sdlKeyModifier & KMOD_CTRL) ? Loader::setUploadTarget(Loader::Hardware) : Loader::setUploadTarget(Loader::Emulator); break;
+                    case File:
+                    {
+                        if(_sdlKeyModifier & KMOD_CTRL) Loader::setUploadTarget(Loader::Hardware);
+                        else if(_sdlKeyModifier & KMOD_SHIFT) Loader::setUploadTarget(Loader::EmulatorLoader);
+                        else Loader::setUploadTarget(Loader::Emulator);
+                    }
+                    break;
                     case Dir: changeBrowseDirectory(); break;
                 }
             }
@@ -907,16 +975,6 @@ namespace Editor
             Cpu::setScanlineMode((Cpu::ScanlineMode)scanlineMode);
         }
 
-        else if(_sdlKeyCode == SDLK_F8)
-        {
-            //_startMusic = !_startMusic;
-        }
-
-        else if(_sdlKeyCode == SDLK_F9)
-        {
-            //Audio::nextScore();
-        }
-
         static EditorMode editorMode = Hex;
         if(_editorMode != editorMode)
         {
@@ -954,7 +1012,7 @@ namespace Editor
         }
 
         // Pause simulation and handle debugging keys
-        while(_singleStepMode)
+        while(_singleStepMode  &&  !getQuitting())
         {
             // Update graphics but only once every 16.66667ms
             static uint64_t prevFrameCounter = 0;
@@ -970,7 +1028,7 @@ namespace Editor
             }
 
             SDL_Event event;
-            while(SDL_PollEvent(&event))
+            while(pollEvent(event))
             {
                 _sdlKeyCode = event.key.keysym.sym;
                 switch(event.type)
@@ -1004,6 +1062,14 @@ namespace Editor
                             _singleStepTicks = SDL_GetTicks();
                             _singleStepWatch = Cpu::getRAM(_singleStepWatchAddress);
                         }
+                        // Rewind and scrub through the recorded frames, the machine continues from wherever it is left
+                        else if(event.key.keysym.sym == _inputKeys["Rewind"]  ||  event.key.keysym.sym == _inputKeys["Scrub-"]  ||  event.key.keysym.sym == _inputKeys["Scrub+"])
+                        {
+                            if(event.key.keysym.sym == _inputKeys["Rewind"]) Rewind::stepBack(REWIND_STEP_FRAMES);
+                            if(event.key.keysym.sym == _inputKeys["Scrub-"]) Rewind::stepBack(1);
+                            if(event.key.keysym.sym == _inputKeys["Scrub+"]) Rewind::stepForward(1);
+                            fprintf(stderr, "Editor::singleStepDebug() : rewound %d of %d frames\n", Rewind::getPosition(), Rewind::getNumFrames());
+                        }
                         else
                         {
                             handleKeyDown();
@@ -1022,10 +1088,60 @@ namespace Editor
         if(_ps2KeyboardDown) (_editorMode == GigaPS2) ? Loader::sendCommandToGiga(event.text.text[0], true) : Cpu::setIN(event.text.text[0]);
     }
 
-    void handleInput(void)
+    // SDL can only be shut down from the thread that owns the window, with the emulation thread it closes the window the same way the
+    // window manager does and main() stops everything once that thread has returned
+    void quit(void)
+    {
+#ifdef EMULATION_THREAD
+        SDL_Event event;
+        event.type = SDL_QUIT;
+        SDL_PushEvent(&event);
+#else
+        // Finishes whatever the writer has queued
+        Capture::stop();
+        Analyser::stop();
+
+        SDL_Quit();
+        exit(0);
+#endif
+    }
+
+    bool queueEvents(void)
     {
         SDL_Event event;
         while(SDL_PollEvent(&event))
+        {
+            if(event.type == SDL_QUIT)
+            {
+                _quitting.store(true, std::memory_order_relaxed);
+                return false;
+            }
+
+            InputEvent inputEvent = {event, Graphics::getPresentedFrame()};
+            if(!Spsc::push(_inputEvents, inputEvent)) fprintf(stderr, "Editor::queueEvents() : input queue is full : event dropped.\n");
+        }
+
+        return true;
+    }
+
+    bool pollEvent(SDL_Event& event)
+    {
+#ifdef EMULATION_THREAD
+        InputEvent inputEvent;
+        if(!Spsc::pop(_inputEvents, inputEvent)) return false;
+
+        event = inputEvent._event;
+        _inputLatency = Graphics::getFrameNumber() - inputEvent._frame;
+        return true;
+#else
+        return SDL_PollEvent(&event) != 0;
+#endif
+    }
+
+    void handleInput(void)
+    {
+        SDL_Event event;
+        while(pollEvent(event))
         {
             _sdlKeyCode = event.key.keysym.sym;
             _sdlKeyModifier = event.key.keysym.mod;
@@ -1035,11 +1151,7 @@ namespace Editor
                 case SDL_TEXTINPUT:  handlePS2key(event);     break;
                 case SDL_KEYDOWN:    handleKeyDown();         break;
                 case SDL_KEYUP:      handleKeyUp();           break;
-                case SDL_QUIT: 
-                {
-                    SDL_Quit();
-                    exit(0);
-                }
+                case SDL_QUIT: quit(); break;
             }
         }
 
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <SDL.h>
 
 
 #define INPUT_RIGHT   0x01
@@ -34,6 +35,8 @@
 
 #define INPUT_CONFIG_INI  "input_config.ini"
 
+#define INPUT_EVENT_QUEUE 256
+
 
 namespace Editor
 {
@@ -45,8 +48,8 @@ namespace Editor
     int getCursorX(void);
     int getCursorY(void);
     bool getHexEdit(void);
-    bool getStartMusic(void);
     bool getSingleStepMode(void);
+    bool getQuitting(void);
     MemoryMode getMemoryMode(void);
     EditorMode getEditorMode(void);
     uint8_t getMemoryDigit(void);
@@ -64,10 +67,10 @@ namespace Editor
     std::string* getFileEntryName(int index);
     std::string* getCurrentFileEntryName(void);
     std::string getBrowserPath(bool removeSlash=false);
+    uint64_t getInputLatency(void);
 
     void setCursorX(int x);
     void setCursorY(int y);
-    void setStartMusic(bool startMusic);
     void setSingleStep(bool singleStep);
     void setSingleStepMode(bool singleStepMode);
     void setLoadBaseAddress(uint16_t address);
@@ -79,6 +82,14 @@ namespace Editor
     void browseDirectory(void);
     bool singleStepDebug(void);
     void handleInput(void);
+    void quit(void);
+
+    // SDL thread, stamps every pending SDL event with the frame on screen and queues it for the emulation thread, returns false once the
+    // window has been closed, (getQuitting() is then true)
+    bool queueEvents(void);
+
+    // Emulation thread, the next queued event, or straight from SDL without EMULATION_THREAD
+    bool pollEvent(SDL_Event& event);
 }
 
 #endif
\ No newline at end of file
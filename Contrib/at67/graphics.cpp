@@ -2,6 +2,8 @@
 #include <iomanip>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <map>
 
 #include "graphics.h"
 #include "memory.h"
@@ -12,11 +14,19 @@
 #include "inih/INIReader.h"
 #include "defaultKeys.h"
 
+#ifdef GRAPHICS_SSE2
+#include <emmintrin.h>
+#endif
+
 // Use this if you ever want to change the default font, but it better be 6x8 per char or otherwise you will be in a world of hurt
 #ifndef CREATE_FONT_HEADER
 #include "emuFont96x48.h"
 #endif
 
+#define FRAME_FRESH 0x04
+
+#define NUM_GLYPHS  ((FONT_BMP_WIDTH/FONT_WIDTH) * (FONT_BMP_HEIGHT/FONT_HEIGHT))
+
 
 namespace Graphics
 {
@@ -25,17 +35,81 @@ namespace Graphics
     bool _resizable = false;
     bool _borderless = true;
     bool _vSync = false;
+    bool _indexedScreen = true;
 
-    bool _displayHelpScreen = false;
-    uint8_t _displayHelpScreenAlpha = 0;
+    // Set on the emulation thread and faded on the SDL thread
+    std::atomic<bool> _displayHelpScreen{false};
+    std::atomic<int> _displayHelpScreenAlpha{0};
 
     uint32_t _pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
     uint32_t _colours[COLOUR_PALETTE];
     uint32_t _hlineTiming[GIGA_HEIGHT];
 
+    // The Gigatron's half of the screen as palette indices, one byte per pixel of every VGA line, expanded at native resolution into
+    // a streaming texture that the renderer scales, the ARGB pixels then only carry the timing column and the menu
+    uint8_t _indices[SCREEN_HEIGHT * GIGA_WIDTH];
+
+    // What refreshScreen() last composed each line from, lines are only recomposed when their page, scroll or page contents change
+    bool _refreshValid = false;
+    uint16_t _refreshLines[GIGA_HEIGHT];
+
+    // Everything right of the Gigatron's screen is split into panes that are each their own texture, drawing into a pane bumps its
+    // version and a pane is only copied to the SDL thread and uploaded again when its version has moved on, the renderer then composes
+    // the Gigatron's screen, the panes and the help overlay
+    enum Pane {PaneTiming=0, PaneLeds, PaneStatus, PaneCpu, PaneTextWindow, PaneFooter, NumPanes};
+    const SDL_Rect _paneRects[NumPanes] =
+    {
+        {GIGA_WIDTH*3, 0,                 MENU_START_X - GIGA_WIDTH*3, SCREEN_HEIGHT                  },
+        {MENU_START_X, 0,                 SCREEN_WIDTH - MENU_START_X, FONT_CELL_Y                    },
+        {MENU_START_X, FONT_CELL_Y,       SCREEN_WIDTH - MENU_START_X, FONT_CELL_Y - 3                },
+        {MENU_START_X, FONT_CELL_Y*2 - 3, SCREEN_WIDTH - MENU_START_X, FONT_CELL_Y + 3                },
+        {MENU_START_X, FONT_CELL_Y*3,     SCREEN_WIDTH - MENU_START_X, SCREEN_HEIGHT - FONT_CELL_Y*5  },
+        {MENU_START_X, SCREEN_HEIGHT - FONT_CELL_Y*2, SCREEN_WIDTH - MENU_START_X, FONT_CELL_Y*2       },
+    };
+    uint32_t _paneVersions[NumPanes] = {1, 1, 1, 1, 1, 1};
+    uint32_t _paneUploaded[NumPanes] = {0};
+
+    // What each pane showed when it was last drawn, a pane is only drawn again when its key changes
+    std::string _paneKeys[NumPanes];
+
+    // Finished frames go from the emulation thread to the SDL thread through three of these, the emulation thread owns _frameBack and
+    // the SDL thread _frameFront, the third is swapped through _frameMiddle along with a flag saying it holds a frame not yet presented
+    struct Frame
+    {
+        uint64_t _number;
+        uint32_t _paneVersions[NumPanes];
+        uint32_t _pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+        uint8_t _indices[SCREEN_HEIGHT * GIGA_WIDTH];
+    };
+
+#ifdef EMULATION_THREAD
+    Frame _frames[3];
+    int _frameBack = 0;
+    int _frameFront = 1;
+    std::atomic<int> _frameMiddle{2};
+#endif
+    uint64_t _frameNumber = 0;
+    std::atomic<uint64_t> _presentedFrame{0};
+
+    // The font as one bit per pixel, (bit 0 is the leftmost column), and every glyph pre-expanded to ARGB for each colour text has
+    // been drawn in, normal and inverted; text is then copied a glyph row at a time instead of being tested a font pixel at a time
+    struct GlyphTiles
+    {
+        uint32_t _tiles[2][NUM_GLYPHS][FONT_HEIGHT][FONT_WIDTH];
+    };
+    uint8_t _glyphRows[NUM_GLYPHS][FONT_HEIGHT];
+    std::map<uint32_t, GlyphTiles> _glyphTiles;
+
+#ifdef GRAPHICS_SSE2
+    // Four copies of each colour, one unaligned store draws a pixel three wide and the next pixel overwrites the fourth
+    __m128i _colours4[COLOUR_PALETTE];
+#endif
+
     SDL_Window* _window = NULL;
     SDL_Renderer* _renderer = NULL;
     SDL_Texture* _screenTexture = NULL;
+    SDL_Texture* _gigaTexture = NULL;
+    SDL_Texture* _paneTextures[NumPanes] = {NULL};
     SDL_Surface* _screenSurface = NULL;
     SDL_Texture* _helpTexture = NULL;
     SDL_Surface* _helpSurface = NULL;
@@ -50,12 +124,17 @@ namespace Graphics
     SDL_Window* getWindow(void) {return _window;}
     SDL_Renderer* getRenderer(void) {return _renderer;}
     SDL_Texture* getScreenTexture(void) {return _screenTexture;}
+    SDL_Texture* getGigaTexture(void) {return _gigaTexture;}
     SDL_Surface* getScreenSurface(void) {return _screenSurface;}
     SDL_Texture* getHelpTexture(void) {return _helpTexture;}
     SDL_Surface* getHelpSurface(void) {return _helpSurface;}
     SDL_Surface* getFontSurface(void) {return _fontSurface;}
 
-    void setDisplayHelpScreen(bool display) {_displayHelpScreen = display;}
+    bool getIndexedScreen(void) {return _indexedScreen;}
+    uint64_t getFrameNumber(void) {return _frameNumber;}
+    uint64_t getPresentedFrame(void) {return _presentedFrame.load(std::memory_order_relaxed);}
+
+    void setDisplayHelpScreen(bool display) {_displayHelpScreen.store(display, std::memory_order_relaxed);}
 
 
     SDL_Surface* createSurface(int width, int height)
@@ -85,6 +164,24 @@ namespace Graphics
         return surface;
     }
 
+    // Screen coordinates, anything drawn outside of every pane is never seen
+    void dirtyPanes(int x, int y, int w, int h)
+    {
+        for(int i=0; i<NumPanes; i++)
+        {
+            const SDL_Rect& rect = _paneRects[i];
+            if(x < rect.x + rect.w  &&  x + w > rect.x  &&  y < rect.y + rect.h  &&  y + h > rect.y) _paneVersions[i]++;
+        }
+    }
+
+    bool paneChanged(Pane pane, const std::string& key)
+    {
+        if(key == _paneKeys[pane]) return false;
+
+        _paneKeys[pane] = key;
+        return true;
+    }
+
     void writeToSurface(const SDL_Surface* surface, const uint32_t* data, int width, int height)
     {
         uint32_t* srcPixels = (uint32_t*)data;
@@ -187,6 +284,64 @@ namespace Graphics
         SDL_SetTextureAlphaMod(_helpTexture, 0);
     }
 
+    void createGlyphRows(void)
+    {
+        uint32_t* fontPixels = (uint32_t*)_fontSurface->pixels;
+        for(int chr=0; chr<NUM_GLYPHS; chr++)
+        {
+            int srcx = (chr % CHARS_PER_ROW)*FONT_WIDTH, srcy = (chr / CHARS_PER_ROW)*FONT_HEIGHT;
+            for(int k=0; k<FONT_HEIGHT; k++)
+            {
+                uint8_t bits = 0;
+                for(int j=0; j<FONT_WIDTH; j++)
+                {
+                    if(fontPixels[(srcx + j)  +  (srcy + k)*FONT_BMP_WIDTH]) bits |= 1 << j;
+                }
+                _glyphRows[chr][k] = bits;
+            }
+        }
+    }
+
+    // Colours are few, (white, green, grey, cyan and the like), so each is expanded the first time it is used and kept
+    const GlyphTiles& getGlyphTiles(uint32_t colour)
+    {
+        static uint32_t lastColour = 0x00000000;
+        static const GlyphTiles* lastTiles = NULL;
+        if(lastTiles  &&  colour == lastColour) return *lastTiles;
+
+        bool created = _glyphTiles.find(colour) == _glyphTiles.end();
+        GlyphTiles& glyphTiles = _glyphTiles[colour];
+        if(created)
+        {
+            for(int chr=0; chr<NUM_GLYPHS; chr++)
+            {
+                for(int k=0; k<FONT_HEIGHT; k++)
+                {
+                    for(int j=0; j<FONT_WIDTH; j++)
+                    {
+                        bool set = (_glyphRows[chr][k] >> j) & 1;
+                        glyphTiles._tiles[0][chr][k][j] = set ? colour : 0xFF000000;
+                        glyphTiles._tiles[1][chr][k][j] = set ? 0xFF000000 : colour;
+                    }
+                }
+            }
+        }
+
+        lastColour = colour;
+        lastTiles = &glyphTiles;
+        return glyphTiles;
+    }
+
+    void blitGlyphRow(uint32_t* dst, const uint32_t* src)
+    {
+#ifdef GRAPHICS_SSE2
+        _mm_storeu_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+        _mm_storel_epi64((__m128i*)(dst + 4), _mm_loadl_epi64((const __m128i*)(src + 4)));
+#else
+        memcpy(dst, src, FONT_WIDTH*sizeof(uint32_t));
+#endif
+    }
+
     bool getKeyAsString(const std::string& sectionString, const std::string& iniKey, const std::string& defaultKey, std::string& result)
     {
         result = _iniReader.Get(sectionString, iniKey, defaultKey);
@@ -214,6 +369,9 @@ namespace Graphics
             p |= g << 8;
             p |= b << 0;
             _colours[i] = p;
+#ifdef GRAPHICS_SSE2
+            _colours4[i] = _mm_set1_epi32(int(p));
+#endif
         }
 
         // Desktop resolution by default
@@ -225,6 +383,7 @@ namespace Graphics
         _resizable = false;
         _borderless = true;
         _vSync = false;
+        _indexedScreen = true;
 
         // Parse graphics config file
         INIReader iniReader(GRAPHICS_CONFIG_INI);
@@ -260,6 +419,8 @@ namespace Graphics
                         _borderless = strtol(result.c_str(), nullptr, 10);
                         getKeyAsString(sectionString, "VSync", "0", result);        
                         _vSync = strtol(result.c_str(), nullptr, 10);
+                        getKeyAsString(sectionString, "IndexedScreen", "1", result);        
+                        _indexedScreen = strtol(result.c_str(), nullptr, 10);
 
                         getKeyAsString(sectionString, "Width", "DESKTOP", result);
                          _width = (result == "DESKTOP") ? _width : _width = strtol(result.c_str(), nullptr, 10);
@@ -308,6 +469,36 @@ namespace Graphics
             _EXIT_(EXIT_FAILURE);
         }
 
+        // Indexed screen, a software renderer would only be doing the same expansion and scaling on the CPU so it keeps the ARGB path
+        SDL_RendererInfo rendererInfo;
+        if(SDL_GetRendererInfo(_renderer, &rendererInfo) < 0  ||  !(rendererInfo.flags & SDL_RENDERER_ACCELERATED)) _indexedScreen = false;
+        if(_indexedScreen)
+        {
+            _gigaTexture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, GIGA_WIDTH, SCREEN_HEIGHT);
+            if(_gigaTexture == NULL)
+            {
+                fprintf(stderr, "Graphics::initialise() : failed to create streaming texture : reverting to ARGB screen.\n");
+                _indexedScreen = false;
+            }
+            else
+            {
+                SDL_SetTextureBlendMode(_gigaTexture, SDL_BLENDMODE_NONE);
+            }
+        }
+
+        // Pane textures, static as most of them go many frames between uploads
+        for(int i=0; i<NumPanes; i++)
+        {
+            _paneTextures[i] = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, _paneRects[i].w, _paneRects[i].h);
+            if(_paneTextures[i] == NULL)
+            {
+                SDL_Quit();
+                fprintf(stderr, "Graphics::initialise() :  failed to create SDL pane texture.\n");
+                _EXIT_(EXIT_FAILURE);
+            }
+            SDL_SetTextureBlendMode(_paneTextures[i], SDL_BLENDMODE_NONE);
+        }
+
         // Screen surface
         _screenSurface = SDL_GetWindowSurface(_window);
         if(_screenSurface == NULL)
@@ -341,6 +532,8 @@ namespace Graphics
         writeToSurface(_fontSurface, _emuFont96x48, FONT_BMP_WIDTH, FONT_BMP_HEIGHT);
 #endif
 
+        createGlyphRows();
+
         // Help screen
         _helpSurface = createSurface(SCREEN_WIDTH, SCREEN_HEIGHT);
         createHelpTexture();
@@ -362,50 +555,100 @@ namespace Graphics
         if(debugging) return;
 
         uint32_t screen = (vgaX % SCREEN_WIDTH)*3 + (pixelY % GIGA_HEIGHT)*4*SCREEN_WIDTH;
+        if(_pixels[screen] != colour) dirtyPanes((vgaX % SCREEN_WIDTH)*3, (pixelY % GIGA_HEIGHT)*4, 3, 4);
         _pixels[screen + 0 + 0*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 0*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 0*SCREEN_WIDTH] = colour;
         _pixels[screen + 0 + 1*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 1*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 1*SCREEN_WIDTH] = colour;
         _pixels[screen + 0 + 2*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 2*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 2*SCREEN_WIDTH] = colour;
         _pixels[screen + 0 + 3*SCREEN_WIDTH] = 0x00;   _pixels[screen + 1 + 3*SCREEN_WIDTH] = 0x00;   _pixels[screen + 2 + 3*SCREEN_WIDTH] = 0x00;
     }
 
-    void refreshPixel(const Cpu::State& S, int vgaX, int vgaY, bool debugging)
+    void drawScanline(const uint8_t* scanline, int length, int vgaY)
     {
-        if(debugging) return;
+        if(_indexedScreen)
+        {
+            memcpy(&_indices[vgaY*GIGA_WIDTH], scanline, length);
+            return;
+        }
+
+        uint32_t* pixels = &_pixels[vgaY*SCREEN_WIDTH];
+        int x = 0;
+#ifdef GRAPHICS_SSE2
+        // The last pixel is left to the scalar loop, its fourth copy would land on the timing column
+        for(; x<length-1; x++) _mm_storeu_si128((__m128i*)&pixels[x*3], _colours4[scanline[x] & (COLOUR_PALETTE-1)]);
+#endif
+        for(; x<length; x++)
+        {
+            uint32_t colour = _colours[scanline[x] & (COLOUR_PALETTE-1)];
+            pixels[x*3 + 0] = colour;
+            pixels[x*3 + 1] = colour;
+            pixels[x*3 + 2] = colour;
+        }
+    }
+
+    // Converts the OUT bytes of one line, pixels past length weren't drawn this line and keep whatever they had, (horizontal timing errors)
+    void refreshScanline(const uint8_t* scanline, int length, int vgaY, bool debugging)
+    {
+        if(debugging  ||  vgaY < 0  ||  vgaY >= SCREEN_HEIGHT) return;
+
+        // The running machine owns the screen again, the next refreshScreen() starts from scratch
+        _refreshValid = false;
 
-        uint32_t colour = _colours[S._OUT & (COLOUR_PALETTE-1)];
-        uint32_t address = (vgaX % SCREEN_WIDTH)*3 + (vgaY % SCREEN_HEIGHT)*SCREEN_WIDTH;
-        _pixels[address + 0] = colour;
-        _pixels[address + 1] = colour;
-        _pixels[address + 2] = colour;
+        drawScanline(scanline, length, vgaY);
     }
 
+    // Rebuilds the screen from the vTable and video RAM while paused, only lines whose page, scroll or page contents changed are redrawn
     void refreshScreen(void)
     {
-        uint8_t offsetx = 0;
+        const uint8_t* ram = Cpu::getPtrToRAM();
+        const uint8_t* dirtyPages = Cpu::getDirtyPages();
 
+        uint8_t offsetx = 0;
         for(int y=0; y<GIGA_HEIGHT; y++)
         {
             offsetx += Cpu::getRAM(GIGA_VTABLE + 1 + y*2);
-    
-            for(int x=0; x<=GIGA_WIDTH; x++)
+            uint8_t page = Cpu::getRAM(GIGA_VTABLE + y*2) & (RAM_DIRTY_PAGES-1);
+            uint16_t line = (page <<8) | offsetx;
+
+            if(!_refreshValid  ||  _refreshLines[y] != line  ||  (dirtyPages[page] & DIRTY_PAGE_VIDEO))
             {
-                uint16_t address = (Cpu::getRAM(GIGA_VTABLE + y*2) <<8) + ((offsetx + x) & 0xFF);
-                uint32_t colour = (x < GIGA_WIDTH) ? _colours[Cpu::getRAM(address) & (COLOUR_PALETTE-1)] : _hlineTiming[y];
-                uint32_t screen = (y*4 % SCREEN_HEIGHT)*SCREEN_WIDTH  +  (x*3 % SCREEN_WIDTH);
-
-                _pixels[screen + 0 + 0*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 0*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 0*SCREEN_WIDTH] = colour;
-                _pixels[screen + 0 + 1*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 1*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 1*SCREEN_WIDTH] = colour;
-                _pixels[screen + 0 + 2*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 2*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 2*SCREEN_WIDTH] = colour;
-                _pixels[screen + 0 + 3*SCREEN_WIDTH] = 0x00;   _pixels[screen + 1 + 3*SCREEN_WIDTH] = 0x00;   _pixels[screen + 2 + 3*SCREEN_WIDTH] = 0x00;
+                _refreshLines[y] = line;
+
+                // A line never leaves its page, so it is at most two block copies with the wrap
+                uint8_t scanline[GIGA_WIDTH];
+                int length = std::min(256 - offsetx, GIGA_WIDTH);
+                memcpy(&scanline[0], &ram[(page <<8) + offsetx], length);
+                memcpy(&scanline[length], &ram[page <<8], GIGA_WIDTH - length);
+
+                for(int i=0; i<3; i++) drawScanline(scanline, GIGA_WIDTH, y*4 + i);
+                if(_indexedScreen)
+                {
+                    memset(&_indices[(y*4 + 3)*GIGA_WIDTH], 0x00, GIGA_WIDTH);
+                }
+                else
+                {
+                    memset(&_pixels[(y*4 + 3)*SCREEN_WIDTH], 0x00, GIGA_WIDTH*3*sizeof(uint32_t));
+                }
             }
+
+            uint32_t colour = _hlineTiming[y];
+            uint32_t screen = y*4*SCREEN_WIDTH + GIGA_WIDTH*3;
+            if(_pixels[screen] != colour) dirtyPanes(GIGA_WIDTH*3, y*4, 3, 4);
+            _pixels[screen + 0 + 0*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 0*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 0*SCREEN_WIDTH] = colour;
+            _pixels[screen + 0 + 1*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 1*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 1*SCREEN_WIDTH] = colour;
+            _pixels[screen + 0 + 2*SCREEN_WIDTH] = colour; _pixels[screen + 1 + 2*SCREEN_WIDTH] = colour; _pixels[screen + 2 + 2*SCREEN_WIDTH] = colour;
+            _pixels[screen + 0 + 3*SCREEN_WIDTH] = 0x00;   _pixels[screen + 1 + 3*SCREEN_WIDTH] = 0x00;   _pixels[screen + 2 + 3*SCREEN_WIDTH] = 0x00;
         }
+
+        Cpu::clearDirtyPages(DIRTY_PAGE_VIDEO);
+        _refreshValid = true;
     }
 
     void drawLeds(void)
     {
-        // Update 60 times per second no matter what the FPS is
-        if(Timing::getFrameTime()  &&  Timing::getFrameUpdate())
+        // Update 60 times per second no matter what the FPS is, but only when the LEDs have changed
+        if(Timing::getFrameTime()  &&  Timing::getFrameUpdate()  &&  paneChanged(PaneLeds, std::string(1, char(Cpu::getXOUT() & ((1 << NUM_LEDS) - 1)))))
         {
+            dirtyPanes(int(float(SCREEN_WIDTH) * 0.866f), 3, NUM_LEDS*NUM_LEDS, 2);
             for(int i=0; i<NUM_LEDS; i++)
             {
                 int mask = 1 << (NUM_LEDS-1 - i);
@@ -434,7 +677,8 @@ namespace Graphics
         }
         if(x<0 || x>=SCREEN_WIDTH || y<0 || y>=SCREEN_HEIGHT) return false;
 
-        uint32_t* fontPixels = (uint32_t*)_fontSurface->pixels;
+        if(pixels == _pixels) dirtyPanes(x, y, int(text.size())*FONT_WIDTH, FONT_HEIGHT);
+
         for(int i=0; i<text.size(); i++)
         {
             if(sectionColour)
@@ -454,31 +698,31 @@ namespace Graphics
             }
 
             uint8_t chr = text.c_str()[i] - 32;
-            uint8_t row = chr % CHARS_PER_ROW;
-            uint8_t col = chr / CHARS_PER_ROW;
-
-            int srcx = row*FONT_WIDTH, srcy = col*FONT_HEIGHT;
-            if(srcx+FONT_WIDTH-1>=FONT_BMP_WIDTH || srcy+FONT_HEIGHT-1>=FONT_BMP_HEIGHT) return false;
+            if(chr >= NUM_GLYPHS) return false;
 
             int dstx = x + i*FONT_WIDTH, dsty = y;
             if(dstx+FONT_WIDTH-1>=SCREEN_WIDTH-FONT_WIDTH || dsty+FONT_HEIGHT-1>=SCREEN_HEIGHT) return false;
 
-            for(int j=0; j<FONT_WIDTH; j++)
+            bool inverted = invert  &&  i<invertSize;
+            uint32_t* dst = &pixels[dstx + dsty*SCREEN_WIDTH];
+            if(colourKey)
             {
-                for(int k=0; k<FONT_HEIGHT; k++)
+                // Only the set pixels are drawn, so there is nothing to copy
+                uint32_t foreground = 0xFF000000 | colour;
+                for(int k=0; k<FONT_HEIGHT; k++, dst+=SCREEN_WIDTH)
                 {
-                    int fontAddress = (srcx + j)  +  (srcy + k)*FONT_BMP_WIDTH;
-                    int pixelAddress = (dstx + j)  +  (dsty + k)*SCREEN_WIDTH;
-                    if((invert  &&  i<invertSize) ? !fontPixels[fontAddress] : fontPixels[fontAddress])
-                    {
-                        pixels[pixelAddress] = 0xFF000000 | colour;
-                    }
-                    else
+                    uint8_t bits = inverted ? ~_glyphRows[chr][k] : _glyphRows[chr][k];
+                    for(int j=0; j<FONT_WIDTH; j++)
                     {
-                        if(!colourKey) pixels[pixelAddress] = 0xFF000000;
+                        if(bits & (1 << j)) dst[j] = foreground;
                     }
                 }
             }
+            else
+            {
+                const GlyphTiles& glyphTiles = getGlyphTiles(0xFF000000 | colour);
+                for(int k=0; k<FONT_HEIGHT; k++, dst+=SCREEN_WIDTH) blitGlyphRow(dst, glyphTiles._tiles[inverted][chr][k]);
+            }
         }
 
         return true;
@@ -491,6 +735,7 @@ namespace Graphics
         if(x<0 || x>=SCREEN_WIDTH || y<0 || y>=SCREEN_HEIGHT) return;
 
         uint32_t pixelAddress = x + digit*FONT_WIDTH + y*SCREEN_WIDTH;
+        dirtyPanes(x + digit*FONT_WIDTH, y + FONT_HEIGHT-1, FONT_WIDTH, 1);
 
         pixelAddress += (FONT_HEIGHT-1)*SCREEN_WIDTH;
         for(int i=0; i<FONT_WIDTH; i++) _pixels[pixelAddress+i] = colour;
@@ -512,6 +757,54 @@ namespace Graphics
         //for(int i=0; i<FONT_HEIGHT; i++) _pixels[pixelAddress-i*SCREEN_WIDTH] = colour;
     }
 
+    void renderScreen(const uint32_t* pixels, const uint8_t* indices, const uint32_t* paneVersions)
+    {
+        // Every texture is stretched to the window the same way, edges are rounded so that neighbouring textures always meet
+        int width, height;
+        SDL_GetRendererOutputSize(_renderer, &width, &height);
+        SDL_Rect gigaRect = {0, 0, GIGA_WIDTH*3, SCREEN_HEIGHT};
+        SDL_Rect gigaDst = {0, 0, width * (GIGA_WIDTH*3) / SCREEN_WIDTH, height};
+
+        if(!_indexedScreen)
+        {
+            SDL_UpdateTexture(_screenTexture, &gigaRect, pixels, SCREEN_WIDTH * sizeof(uint32_t));
+            SDL_RenderCopy(_renderer, _screenTexture, &gigaRect, &gigaDst);
+        }
+        else
+        {
+            // 160*480 palette lookups instead of 640*480 ARGB writes, the 3x horizontal scale is left to the renderer
+            void* texturePixels;
+            int pitch;
+            if(SDL_LockTexture(_gigaTexture, NULL, &texturePixels, &pitch) == 0)
+            {
+                for(int y=0; y<SCREEN_HEIGHT; y++)
+                {
+                    const uint8_t* lineIndices = &indices[y*GIGA_WIDTH];
+                    uint32_t* linePixels = (uint32_t*)((uint8_t*)texturePixels + y*pitch);
+                    for(int x=0; x<GIGA_WIDTH; x++) linePixels[x] = _colours[lineIndices[x] & (COLOUR_PALETTE-1)];
+                }
+                SDL_UnlockTexture(_gigaTexture);
+            }
+            SDL_RenderCopy(_renderer, _gigaTexture, NULL, &gigaDst);
+        }
+
+        // Panes are only uploaded when they have been drawn into since their last upload
+        for(int i=0; i<NumPanes; i++)
+        {
+            const SDL_Rect& rect = _paneRects[i];
+            if(paneVersions[i] != _paneUploaded[i])
+            {
+                SDL_UpdateTexture(_paneTextures[i], NULL, &pixels[rect.y*SCREEN_WIDTH + rect.x], SCREEN_WIDTH * sizeof(uint32_t));
+                _paneUploaded[i] = paneVersions[i];
+            }
+
+            int x0 = width * rect.x / SCREEN_WIDTH, x1 = width * (rect.x + rect.w) / SCREEN_WIDTH;
+            int y0 = height * rect.y / SCREEN_HEIGHT, y1 = height * (rect.y + rect.h) / SCREEN_HEIGHT;
+            SDL_Rect paneDst = {x0, y0, x1 - x0, y1 - y0};
+            SDL_RenderCopy(_renderer, _paneTextures[i], NULL, &paneDst);
+        }
+    }
+
     float powStepRising(float x, float a, float b, float p)
     {
         float f = std::min(std::max(x, a), b);
@@ -530,6 +823,7 @@ namespace Graphics
 
         x += MENU_START_X;
         y += MENU_START_Y;
+        dirtyPanes(x, y, w, h);
 
         for(int j=y; j<(y + h); j++)
         {
@@ -549,6 +843,66 @@ namespace Graphics
         }
     }
 
+    void renderHelpScreen(void);
+
+#ifdef EMULATION_THREAD
+    // Emulation thread, only the Gigatron's screen and the panes that this frame buffer doesn't already hold are copied
+    void publishFrame(void)
+    {
+        Frame& frame = _frames[_frameBack];
+        frame._number = _frameNumber;
+        if(_indexedScreen)
+        {
+            memcpy(frame._indices, _indices, sizeof _indices);
+        }
+        else
+        {
+            for(int y=0; y<SCREEN_HEIGHT; y++) memcpy(&frame._pixels[y*SCREEN_WIDTH], &_pixels[y*SCREEN_WIDTH], GIGA_WIDTH*3*sizeof(uint32_t));
+        }
+
+        for(int i=0; i<NumPanes; i++)
+        {
+            if(frame._paneVersions[i] == _paneVersions[i]) continue;
+
+            const SDL_Rect& rect = _paneRects[i];
+            for(int y=rect.y; y<rect.y + rect.h; y++) memcpy(&frame._pixels[y*SCREEN_WIDTH + rect.x], &_pixels[y*SCREEN_WIDTH + rect.x], rect.w*sizeof(uint32_t));
+            frame._paneVersions[i] = _paneVersions[i];
+        }
+
+        _frameBack = _frameMiddle.exchange(_frameBack | FRAME_FRESH, std::memory_order_acq_rel) & ~FRAME_FRESH;
+    }
+
+    // SDL thread, returns false without touching the renderer when no new frame has been published since the last present
+    bool presentFrame(void)
+    {
+        if(!(_frameMiddle.load(std::memory_order_acquire) & FRAME_FRESH)) return false;
+
+        _frameFront = _frameMiddle.exchange(_frameFront, std::memory_order_acq_rel) & ~FRAME_FRESH;
+        const Frame& frame = _frames[_frameFront];
+        renderScreen(frame._pixels, frame._indices, frame._paneVersions);
+        renderHelpScreen();
+        SDL_RenderPresent(_renderer);
+        _presentedFrame.store(frame._number, std::memory_order_relaxed);
+        return true;
+    }
+#else
+    bool presentFrame(void) {return false;}
+#endif
+
+    void showFrame(void)
+    {
+        _frameNumber++;
+
+#ifdef EMULATION_THREAD
+        publishFrame();
+#else
+        renderScreen(_pixels, _indices, _paneVersions);
+        renderHelpScreen();
+        SDL_RenderPresent(_renderer);
+        _presentedFrame.store(_frameNumber, std::memory_order_relaxed);
+#endif
+    }
+
     void drawUploadBar(float upload)
     {
         int i = Editor::getCursorY();
@@ -561,16 +915,15 @@ namespace Graphics
             sprintf(uploadPercentage, " %3d%%\r", int(upload * 100.0f));
         }
         drawText(uploadFilename, _pixels, HEX_START_X, FONT_CELL_Y*4 + i*FONT_CELL_Y, (Editor::getFileEntryType(index) == Editor::Dir) ? 0xFFA0A0A0 : 0xFFFFFFFF, true, HIGHLIGHT_SIZE);
-        SDL_UpdateTexture(_screenTexture, NULL, _pixels, SCREEN_WIDTH * sizeof(uint32_t));
-        SDL_RenderCopy(_renderer, _screenTexture, NULL, NULL);
-        SDL_RenderPresent(_renderer);
+        _paneKeys[PaneTextWindow].clear();
+        showFrame();
         SDL_Event event;
-        while(SDL_PollEvent(&event));
+        while(Editor::pollEvent(event));
     }
 
     void renderText(void)
     {
-        // Update 60 times per second no matter what the FPS is
+        // Update 60 times per second no matter what the FPS is, each line only when what it shows has changed
         if(Timing::getFrameTime()  &&  Timing::getFrameUpdate())
         {
             char str[32];
@@ -580,17 +933,21 @@ namespace Graphics
             if(count++ == 6)
             {
                 count = 0;
-                sprintf(str, "CPU        A:%04X B:%04X", 0x200, 0x220);
-                drawText(std::string(str), _pixels, 0, FONT_CELL_Y*2, 0xFFFFFFFF, false, 0, false);
                 sprintf(str, "%05.1f%%", Cpu::getvCpuUtilisation() * 100.0);
-                drawUsageBar(Cpu::getvCpuUtilisation(), FONT_WIDTH*4 - 3, FONT_CELL_Y*2 - 3, FONT_WIDTH*6 + 5, FONT_HEIGHT + 5);
-                drawText(std::string(str), _pixels, FONT_WIDTH*4, FONT_CELL_Y*2, 0x80808080, false, 0, true);
+                if(paneChanged(PaneCpu, std::string(str)))
+                {
+                    // The addresses in between belong to the text window
+                    drawText("CPU        A:", _pixels, 0, FONT_CELL_Y*2, 0xFFFFFFFF, false, 0, false);
+                    drawText(" B:", _pixels, CPUB_START - FONT_WIDTH*3, FONT_CELL_Y*2, 0xFFFFFFFF, false, 0, false);
+                    drawUsageBar(Cpu::getvCpuUtilisation(), FONT_WIDTH*4 - 3, FONT_CELL_Y*2 - 3, FONT_WIDTH*6 + 5, FONT_HEIGHT + 5);
+                    drawText(std::string(str), _pixels, FONT_WIDTH*4, FONT_CELL_Y*2, 0x80808080, false, 0, true);
+                }
             }
 
             //drawText(std::string("LEDS:"), _pixels, 0, 0, 0xFFFFFFFF, false, 0);
             sprintf(str, "FPS %5.1f  XOUT %02X IN %02X", 1.0f / Timing::getFrameTime(), Cpu::getXOUT(), Cpu::getIN());
-            drawText(std::string(str), _pixels, 0, FONT_CELL_Y, 0xFFFFFFFF, false, 0);
-            drawText("Mode:        Free:", _pixels, 0, 472 - FONT_CELL_Y, 0xFFFFFFFF, false, 0);
+            if(paneChanged(PaneStatus, std::string(str))) drawText(std::string(str), _pixels, 0, FONT_CELL_Y, 0xFFFFFFFF, false, 0);
+
             sprintf(str, "Hex  ");
             if(Editor::getHexEdit()) sprintf(str, "Edit ");
             if(Editor::getEditorMode() == Editor::Load)         sprintf(str, "Load   ");
@@ -598,17 +955,75 @@ namespace Graphics
             else if(Editor::getEditorMode() == Editor::PS2KB)   sprintf(str, "PS2KB  ");
             else if(Editor::getEditorMode() == Editor::Debug)   sprintf(str, "Debug  ");
             else if(Editor::getEditorMode() == Editor::GigaPS2) sprintf(str, "PS2Giga");
-            drawText(std::string(str), _pixels, 30, 472 - FONT_CELL_Y, 0xFF00FF00, false, 0);
+            std::string mode = str;
             sprintf(str, "%d", Memory::getFreeRAM());
-            drawText(std::string(str), _pixels, 108, 472 - FONT_CELL_Y, 0xFFFFFFFF, false, 0);
-            drawText(std::string(VERSION_STR), _pixels, 30, 472, 0xFFFFFFFF, false, 0);
+            if(paneChanged(PaneFooter, mode + str))
+            {
+                drawText("Mode:        Free:", _pixels, 0, 472 - FONT_CELL_Y, 0xFFFFFFFF, false, 0);
+                drawText(mode, _pixels, 30, 472 - FONT_CELL_Y, 0xFF00FF00, false, 0);
+                drawText(std::string(str), _pixels, 108, 472 - FONT_CELL_Y, 0xFFFFFFFF, false, 0);
+                drawText(std::string(VERSION_STR), _pixels, 30, 472, 0xFFFFFFFF, false, 0);
+            }
         }
     }
 
+    void appendKey(std::string& key, uint32_t value)
+    {
+        key.append((const char*)&value, sizeof(value));
+    }
+
+    bool textWindowChanged(void)
+    {
+        std::string key;
+        appendKey(key, Editor::getEditorMode());
+        appendKey(key, Editor::getMemoryMode());
+        appendKey(key, Editor::getHexEdit());
+        appendKey(key, Editor::getCursorX());
+        appendKey(key, Editor::getCursorY());
+        appendKey(key, Editor::getMemoryDigit());
+        appendKey(key, Editor::getAddressDigit());
+        appendKey(key, Editor::getCpuUsageAddressA());
+        appendKey(key, Editor::getCpuUsageAddressB());
+        appendKey(key, Editor::getHexBaseAddress());
+        appendKey(key, Editor::getLoadBaseAddress());
+        appendKey(key, Editor::getVarsBaseAddress());
+
+        if(Editor::getEditorMode() == Editor::Load)
+        {
+            appendKey(key, Editor::getFileEntriesIndex());
+            for(int i=0; i<HEX_CHARS_Y; i++)
+            {
+                int index = Editor::getFileEntriesIndex() + i;
+                if(index >= int(Editor::getFileEntriesSize())) break;
+                appendKey(key, Editor::getFileEntryType(index));
+                key += *Editor::getFileEntryName(index);
+                key += '\0';
+            }
+        }
+        else
+        {
+            uint16_t hexAddress = Editor::getHexBaseAddress();
+            for(int i=0; i<HEX_CHARS_X*HEX_CHARS_Y; i++)
+            {
+                switch(Editor::getMemoryMode())
+                {
+                    case Editor::RAM:  key += char(Cpu::getRAM(hexAddress + i));    break;
+                    case Editor::ROM0: key += char(Cpu::getROM(hexAddress + i, 0)); break;
+                    case Editor::ROM1: key += char(Cpu::getROM(hexAddress + i, 1)); break;
+                }
+            }
+        }
+
+        uint16_t varsAddress = Editor::getVarsBaseAddress();
+        for(int i=0; i<HEX_CHARS_X*2; i++) key += char(Cpu::getRAM(varsAddress + i));
+
+        return paneChanged(PaneTextWindow, key);
+    }
+
     void renderTextWindow(void)
     {
-        // Update 60 times per second no matter what the FPS is
-        if(Timing::getFrameTime()  &&  Timing::getFrameUpdate())
+        // Update 60 times per second no matter what the FPS is, but only when what it shows has changed
+        if(Timing::getFrameTime()  &&  Timing::getFrameUpdate()  &&  textWindowChanged())
         {
             char str[32] = "";
 
@@ -716,23 +1131,27 @@ namespace Graphics
 
     void renderHelpScreen(void)
     {
+        bool display = _displayHelpScreen.load(std::memory_order_relaxed);
+        int alpha = _displayHelpScreenAlpha.load(std::memory_order_relaxed);
+
         // Only display help screen if it is enabled or has alpha > 0
-        if(_displayHelpScreen  ||  _displayHelpScreenAlpha)
+        if(display  ||  alpha)
         {
-            SDL_SetTextureAlphaMod(_helpTexture, _displayHelpScreenAlpha);
+            SDL_SetTextureAlphaMod(_helpTexture, uint8_t(alpha));
             SDL_RenderCopy(_renderer, _helpTexture, NULL, NULL);
             // Fade help screen in
-            if(_displayHelpScreen  &&  _displayHelpScreenAlpha < 220)
+            if(display  &&  alpha < 220)
             {
-                _displayHelpScreenAlpha += 10;
-                if(_displayHelpScreenAlpha > 220) _displayHelpScreenAlpha = 220;
+                alpha += 10;
+                if(alpha > 220) alpha = 220;
             }
             // Fade help screen out
-            if(!_displayHelpScreen  &&  _displayHelpScreenAlpha > 0)
+            if(!display  &&  alpha > 0)
             {
-                _displayHelpScreenAlpha -= 10;
-                if(_displayHelpScreenAlpha < 0) _displayHelpScreenAlpha = 0;
+                alpha -= 10;
+                if(alpha < 0) alpha = 0;
             }
+            _displayHelpScreenAlpha.store(alpha, std::memory_order_relaxed);
         }
     }
 
@@ -742,10 +1161,7 @@ namespace Graphics
         renderText();
         renderTextWindow();
 
-        SDL_UpdateTexture(_screenTexture, NULL, _pixels, SCREEN_WIDTH * sizeof(uint32_t));
-        SDL_RenderCopy(_renderer, _screenTexture, NULL, NULL);
-        renderHelpScreen();
-        SDL_RenderPresent(_renderer);
+        showFrame();
         if(synchronise) Timing::synchronise();
     }
 
@@ -39,6 +39,13 @@
 
 #define GRAPHICS_CONFIG_INI  "graphics_config.ini"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#define GRAPHICS_SSE2
+#endif
+
+// Emulation runs on its own thread and hands finished frames to the SDL thread, comment this out to do everything on one thread
+#define EMULATION_THREAD
+
 
 namespace Graphics
 {
@@ -48,11 +55,15 @@ namespace Graphics
     SDL_Window* getWindow(void);
     SDL_Renderer* getRenderer(void);
     SDL_Texture* getScreenTexture(void);
+    SDL_Texture* getGigaTexture(void);
     SDL_Surface* getScreenSurface(void);
     SDL_Texture* getHelpTexture(void);
     SDL_Surface* getHelpSurface(void);
     SDL_Surface* getFontSurface(void);
 
+    bool getIndexedScreen(void);
+    uint64_t getFrameNumber(void);
+    uint64_t getPresentedFrame(void);
     void setDisplayHelpScreen(bool display);
 
     void initialise(void);
@@ -60,7 +71,7 @@ namespace Graphics
     void resetVTable(void);
 
     void refreshTimingPixel(const Cpu::State& S, int vgaX, int pixelY, uint32_t colour, bool debugging);
-    void refreshPixel(const Cpu::State& S, int vgaX, int vgaY, bool debugging);
+    void refreshScanline(const uint8_t* scanline, int length, int vgaY, bool debugging);
     void refreshScreen(void);
 
     void drawLeds(void);
@@ -68,10 +79,17 @@ namespace Graphics
     void drawDigitBox(uint8_t digit, int x, int y, uint32_t colour);
     void drawUploadBar(float upload);
 
+    void renderScreen(const uint32_t* pixels, const uint8_t* indices, const uint32_t* paneVersions);
     void renderText(void);
     void renderTextWindow(void);
     void render(bool synchronise=true);
 
+    // Hands the frame to the SDL thread, or presents it on this one without EMULATION_THREAD
+    void showFrame(void);
+
+    // SDL thread, presents the latest finished frame if there is one
+    bool presentFrame(void);
+
     void drawLine(int x, int y, int x2, int y2, uint32_t colour);
     void drawLineGiga(uint16_t x, uint16_t y, uint16_t x2, uint16_t y2, uint8_t colour);
     void life(bool initialise);
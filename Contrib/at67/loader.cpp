@@ -7,7 +7,6 @@
 
 #ifndef STAND_ALONE
 #include "editor.h"
-#include "timing.h"
 #include "graphics.h"
 #include "inih/INIReader.h"
 #include "rs232/rs232.h"
@@ -34,6 +33,7 @@
 #include "compiler.h"
 #include "assembler.h"
 #include "expression.h"
+#include "timing.h"
 
 
 #define DEFAULT_COM_BAUD_RATE 115200
@@ -245,10 +245,6 @@ namespace Loader
 
 
 #ifndef STAND_ALONE
-    enum LoaderState {FirstByte=0, MsgLength, LowAddress, HighAddress, Message, LastByte, ResetIN, NumLoaderStates};
-    enum FrameState {Resync=0, Frame, Execute, NumFrameStates};
-
-
     UploadTarget _uploadTarget = None;
     bool _disableUploads = false;
 
@@ -951,7 +947,10 @@ namespace Loader
                 gt1FileBuilt = true;
             }
         }
-        
+
+        // Loader only takes a gt1's RAM segments, a .gtb's program is written straight into TinyBasic's memory
+        if(uploadTarget == EmulatorLoader  &&  isGtbFile) uploadTarget = Emulator;
+
         // Upload gt1
         if(filename.find(".gt1") != filename.npos)
         {
@@ -1017,10 +1016,12 @@ namespace Loader
                     gt1Segment._hiAddress = (address & 0xFF00) >>8;
                 }
 
-                if(uploadTarget == Emulator  &&  !_disableUploads)
+                // Native code can't go through Loader, it is written to the emulated ROM either way
+                if((uploadTarget == Emulator  ||  (uploadTarget == EmulatorLoader  &&  byteCode._isRomAddress))  &&  !_disableUploads)
                 {
-                    (byteCode._isRomAddress) ? Cpu::setROM(customAddress, address++, byteCode._data) : Cpu::setRAM(address++, byteCode._data);
+                    (byteCode._isRomAddress) ? Cpu::setROM(customAddress, address, byteCode._data) : Cpu::setRAM(address, byteCode._data);
                 }
+                address++;
                 gt1Segment._dataBytes.push_back(byteCode._data);
             }
 
@@ -1047,7 +1048,7 @@ namespace Loader
         uint16_t totalSize = printGt1Stats(filename, gt1File);
         Memory::setFreeRAM(Memory::getBaseFreeRAM() - totalSize); 
 
-        if(uploadTarget == Emulator)
+        if(uploadTarget == Emulator  ||  uploadTarget == EmulatorLoader)
         {
             size_t i = filename.find('.');
             _currentGame = (i != std::string::npos) ? filename.substr(0, i) : filename;
@@ -1059,8 +1060,13 @@ namespace Loader
                 loadGtbFile(gtbFilepath);
             }
 
+            // Streamed through the emulated Loader protocol, which executes it once it has all been sent
+            if(!_disableUploads  &&  hasRamCode  &&  uploadTarget == EmulatorLoader)
+            {
+                startUpload(gt1File);
+            }
             // Execute code
-            if(!_disableUploads  &&  hasRamCode)
+            else if(!_disableUploads  &&  hasRamCode)
             {
                 Cpu::setRAM(0x0016, executeAddress-2 & 0x00FF);
                 Cpu::setRAM(0x0017, (executeAddress & 0xFF00) >>8);
@@ -1087,6 +1093,93 @@ namespace Loader
 
         return;
     }
+#endif
+
+#if !defined(STAND_ALONE)  ||  defined(HEADLESS)
+    UploadState _uploadState;
+    UploadReport _uploadReport;
+
+    std::vector<Packet> _packets;
+    uint16_t _executeAddress = 0x0000;
+
+
+    bool getUploading(void) {return _uploadState._frameUploading;}
+    const UploadReport& getUploadReport(void) {return _uploadReport;}
+
+    void getUploadState(UploadState& uploadState) {uploadState = _uploadState;}
+
+    // Only the position is restored, a position past the packets that are loaded belongs to some other upload
+    void setUploadState(const UploadState& uploadState)
+    {
+        _uploadState = uploadState;
+        if(_uploadState._packetIdx > int(_packets.size())) _uploadState._frameUploading = false;
+    }
+
+
+    bool startUpload(const Gt1File& gt1File)
+    {
+        std::vector<Packet> packets;
+        for(int j=0; j<int(gt1File._segments.size()); j++)
+        {
+            const Gt1Segment& segment = gt1File._segments[j];
+            uint16_t address = segment._loAddress + (segment._hiAddress <<8);
+            if(segment._isRomAddress)
+            {
+                fprintf(stderr, "Loader::startUpload() : ROM segment at 0x%04x can't be sent to Loader, skipping it\n", address);
+                continue;
+            }
+
+            int size = int(segment._dataBytes.size());
+            for(int offset=0; offset<size; )
+            {
+                Packet packet;
+                packet._address = address;
+                packet._length = uint8_t(std::min(std::min(PAYLOAD_SIZE, size - offset), 0x0100 - (address & 0x00FF)));
+                for(int i=0; i<packet._length; i++) packet._data[i] = segment._dataBytes[offset + i];
+                packets.push_back(packet);
+
+                address += packet._length;
+                offset += packet._length;
+            }
+        }
+
+        if(packets.empty())
+        {
+            fprintf(stderr, "Loader::startUpload() : nothing to send to Loader\n");
+            return false;
+        }
+
+        _packets.swap(packets);
+        _executeAddress = gt1File._loStart + (gt1File._hiStart <<8);
+        _uploadReport = UploadReport();
+        _uploadState = UploadState();
+        _uploadState._frameUploading = true;
+        _uploadState._frameState = Boot;
+
+        Cpu::setIN(0xFF);
+        Cpu::reset();
+
+        return true;
+    }
+
+    // Whatever Loader dropped is still whatever was in RAM before, segments can overlap so the last packet to each address is the one
+    // that counts
+    int verifyPackets(void)
+    {
+        std::vector<int16_t> expected(0x10000, -1);
+        for(int j=0; j<int(_packets.size()); j++)
+        {
+            for(int i=0; i<_packets[j]._length; i++) expected[uint16_t(_packets[j]._address + i)] = _packets[j]._data[i];
+        }
+
+        int mismatches = 0;
+        for(int i=0; i<int(expected.size()); i++)
+        {
+            if(expected[i] >= 0  &&  Cpu::getRAM(uint16_t(i)) != uint8_t(expected[i])) mismatches++;
+        }
+
+        return mismatches;
+    }
 
     void sendByte(uint8_t value, uint8_t& checksum)
     {
@@ -1094,10 +1187,10 @@ namespace Loader
         checksum += value;
     }
 
-    bool sendFrame(int vgaY, uint8_t firstByte, uint8_t* message, uint8_t len, uint16_t address, uint8_t& checksum)
+    bool sendFrame(int vgaY, uint8_t firstByte, const uint8_t* message, uint8_t len, uint16_t address, uint8_t& checksum)
     {
-        static LoaderState loaderState = LoaderState::FirstByte;
-        static uint8_t payload[PAYLOAD_SIZE];
+        LoaderState& loaderState = _uploadState._loaderState;
+        uint8_t* payload = _uploadState._payload;
 
         bool sending = true;
 
@@ -1147,7 +1240,7 @@ namespace Loader
 
             case LoaderState::Message: // 8*PAYLOAD_SIZE bits
             {
-                static int msgIdx = 0;
+                int& msgIdx = _uploadState._msgIdx;
                 if(vgaY == VSYNC_START+38+msgIdx*8)
                 {
                     sendByte(payload[msgIdx], checksum);
@@ -1182,67 +1275,127 @@ namespace Loader
                 }
             }
             break;
+
+            default: break;
         }
 
         return sending;
     }
 
-    // TODO: fix the Gigatron version of upload so that it can send more than 60 total bytes, (i.e. break up the payload into multiple packets of 60, 1 packet per frame)
+    // Down to the bottom of the menu then A, each press held and then released for LOADER_PRESS_FRAMES, then Loader is given time to
+    // start; returns false once it has had it
+    bool pressButtons(int frame)
+    {
+        int press = frame / (LOADER_PRESS_FRAMES*2);
+        bool held = (frame % (LOADER_PRESS_FRAMES*2)) < LOADER_PRESS_FRAMES;
+        if(press < LOADER_MENU_DOWNS)
+        {
+            Cpu::setIN(held ? ~LOADER_BUTTON_DOWN : 0xFF);
+        }
+        else if(press == LOADER_MENU_DOWNS)
+        {
+            Cpu::setIN(held ? ~LOADER_BUTTON_A : 0xFF);
+        }
+
+        return frame < (LOADER_MENU_DOWNS + 1)*LOADER_PRESS_FRAMES*2 + LOADER_START_FRAMES;
+    }
+
+    void reportUpload(void)
+    {
+        UploadReport& report = _uploadReport;
+        report._packets = int(_packets.size());
+        report._seconds = double(Cpu::getClock() - _uploadState._startClock) / double(CLOCK_FREQ);
+
+        fprintf(stderr, "Loader::upload() : %d bytes in %d packets : %d frames : %.3f seconds : %.1f bytes/s", report._bytes, report._packets, report._frames, report._seconds,
+                                                                                                              (report._seconds > 0.0) ? double(report._bytes) / report._seconds : 0.0);
+        (report._mismatches) ? fprintf(stderr, " : %d bytes dropped by Loader\n", report._mismatches) : fprintf(stderr, "\n");
+    }
+
+    // One packet per frame, the same frames the Arduino interface sends: a resync frame that doesn't start with 'L' so that Loader
+    // restarts its checksum at 'g', the packets with each frame's checksum carried into the next, then an empty frame to execute
     void upload(int vgaY)
     {
-        static bool frameUploading = false;
-        static FILE* fileToUpload = NULL;
-        static FILE* fileToSave = NULL;
-        static uint8_t payload[RAM_SIZE];
-        static uint8_t payloadSize = 0;
+#ifndef STAND_ALONE
+        if(_uploadTarget != None)
+        {
+            uploadDirect(_uploadTarget);
+            _uploadTarget = None;
+
+            return;
+        }
+#endif
 
-        if(_uploadTarget != None  ||  frameUploading)
+        if(!_uploadState._frameUploading) return;
+
+        uint8_t& checksum = _uploadState._checksum;
+        FrameState& frameState = _uploadState._frameState;
+        int& frameCount = _uploadState._frameCount;
+        int& packetIdx = _uploadState._packetIdx;
+
+        switch(frameState)
         {
-            uint16_t executeAddress = Editor::getLoadBaseAddress();
-            if(_uploadTarget != None)
+            case FrameState::Boot:
             {
-                uploadDirect(_uploadTarget);
-                _uploadTarget = None;
-                //frameUploading = true;
+                if(vgaY == VSYNC_START  &&  ++frameCount >= LOADER_BOOT_FRAMES)
+                {
+                    frameCount = 0;
+                    frameState = FrameState::Menu;
+                }
+            }
+            break;
 
-                return;
+            case FrameState::Menu:
+            {
+                if(vgaY == VSYNC_START  &&  !pressButtons(frameCount++))
+                {
+                    frameCount = 0;
+                    frameState = FrameState::Resync;
+                    _uploadState._startClock = Cpu::getClock();
+                }
             }
-            
-            static uint8_t checksum = 0;
-            static FrameState frameState = FrameState::Resync;
+            break;
 
-            switch(frameState)
+            case FrameState::Resync:
             {
-                case FrameState::Resync:
+                if(!sendFrame(vgaY, 0xFF, _uploadState._payload, 0, 0x0000, checksum))
                 {
-                    if(!sendFrame(vgaY, -1, payload, payloadSize, executeAddress, checksum))
-                    {
-                        checksum = 'g'; // loader resets checksum
-                        frameState = FrameState::Frame;
-                    }
+                    checksum = 'g'; // loader resets checksum
+                    frameState = FrameState::Frame;
+                    _uploadReport._frames++;
                 }
-                break;
+            }
+            break;
 
-                case FrameState::Frame:
+            case FrameState::Frame:
+            {
+                const Packet& packet = _packets[packetIdx];
+                if(!sendFrame(vgaY, 'L', packet._data, packet._length, packet._address, checksum))
                 {
-                    if(!sendFrame(vgaY,'L', payload, payloadSize, executeAddress, checksum))
-                    {
-                        frameState = FrameState::Execute;
-                    }
+                    _uploadReport._bytes += packet._length;
+                    _uploadReport._frames++;
+                    if(++packetIdx == int(_packets.size())) frameState = FrameState::Execute;
                 }
-                break;
+            }
+            break;
+
+            case FrameState::Execute:
+            {
+                // Loader copies each packet while it receives the next frame's payload, so the last one is in RAM by the execute frame's
+                // checksum, which is before Loader can act on it
+                if(vgaY == VSYNC_START+38+PAYLOAD_SIZE*8  &&  _uploadState._loaderState == LoaderState::LastByte) _uploadReport._mismatches = verifyPackets();
 
-                case FrameState::Execute:
+                if(!sendFrame(vgaY, 'L', _uploadState._payload, 0, _executeAddress, checksum))
                 {
-                    if(!sendFrame(vgaY, 'L', payload, 0, executeAddress, checksum))
-                    {
-                        checksum = 0;
-                        frameState = FrameState::Resync;
-                        frameUploading = false;
-                    }
+                    checksum = 0;
+                    frameState = FrameState::Resync;
+                    _uploadState._frameUploading = false;
+                    _uploadReport._frames++;
+                    reportUpload();
                 }
-                break;
             }
+            break;
+
+            default: break;
         }
     }
 #endif
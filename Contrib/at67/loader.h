@@ -14,6 +14,15 @@
 #define DEFAULT_START_ADDRESS_HI  0x02
 #define DEFAULT_START_ADDRESS_LO  0x00
 
+// Arduino interface's way into Loader from the main menu, enough presses of down to reach the bottom entry and then A, each press
+// held and released for LOADER_PRESS_FRAMES; the ROM needs LOADER_BOOT_FRAMES to reach the menu and LOADER_START_FRAMES to start it
+#define LOADER_MENU_DOWNS    10
+#define LOADER_PRESS_FRAMES  3
+#define LOADER_BOOT_FRAMES   150
+#define LOADER_START_FRAMES  120
+#define LOADER_BUTTON_DOWN   0x04
+#define LOADER_BUTTON_A      0x80
+
 #define LOADER_CONFIG_INI  "loader_config.ini"
 #define HIGH_SCORES_INI    "high_scores.ini"
 
@@ -43,9 +52,64 @@ namespace Loader
     uint16_t printGt1Stats(const std::string& filename, const Gt1File& gt1File);
 
 
+#if !defined(STAND_ALONE)  ||  defined(HEADLESS)
+    enum LoaderState {FirstByte=0, MsgLength, LowAddress, HighAddress, Message, LastByte, ResetIN, NumLoaderStates};
+    enum FrameState {Boot=0, Menu, Resync, Frame, Execute, NumFrameStates};
+
+    // One Loader frame of a gt1, never more than PAYLOAD_SIZE bytes and never across a page, the ROM's payload copy only steps the
+    // low byte of the address
+    struct Packet
+    {
+        uint16_t _address = 0x0000;
+        uint8_t _length = 0;
+        uint8_t _data[PAYLOAD_SIZE] = {0};
+    };
+
+    // Emulated Loader protocol, the frame being sent through IN and where it is up to in the packets, kept together so it can be saved
+    // and restored; the packets themselves come from the gt1 and are kept by the loader
+    struct UploadState
+    {
+        bool _frameUploading = false;
+        uint8_t _checksum = 0;
+        FrameState _frameState = Resync;
+        LoaderState _loaderState = FirstByte;
+        int _msgIdx = 0;
+        uint8_t _payload[PAYLOAD_SIZE] = {0};
+        int _packetIdx = 0;
+        int _frameCount = 0;
+        int64_t _startClock = 0;
+    };
+
+    // Emulated time from the resync frame to the end of the execute frame, bytes that weren't in RAM when the execute frame started
+    // are data the ROM's Loader dropped, (a bad checksum is ignored and the Loader waits for the next frame)
+    struct UploadReport
+    {
+        int _bytes = 0;
+        int _packets = 0;
+        int _frames = 0;
+        int _mismatches = 0;
+        double _seconds = 0.0;
+    };
+
+
+    void getUploadState(UploadState& uploadState);
+    void setUploadState(const UploadState& uploadState);
+
+    bool getUploading(void);
+    const UploadReport& getUploadReport(void);
+
+    // Resets the machine, starts Loader from the main menu the way the Arduino interface does and streams every RAM segment of the
+    // gt1 one packet per frame, then executes it; ROM segments can't go through the Loader and are skipped
+    bool startUpload(const Gt1File& gt1File);
+
+    // Called on every rising hSync edge, the Loader reads IN on fixed lines of vertical blank
+    void upload(int vgaY);
+#endif
+
+
 #ifndef STAND_ALONE
     enum Endianness {Little, Big};
-    enum UploadTarget {None, Emulator, Hardware};
+    enum UploadTarget {None, Emulator, EmulatorLoader, Hardware};
 
     struct SaveData
     {
@@ -72,9 +136,7 @@ namespace Loader
     void loadHighScore(void);
     void saveHighScore(void);
     void updateHighScore(void);
-
-    void upload(int vgaY);
 #endif
 }
 
-#endif
+#endif
\ No newline at end of file
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#include "memory.h"
+#include "cpu.h"
+#include "pool.h"
+#include "lockstep.h"
+#include "lockstepKernel.h"
+
+#ifdef LOCKSTEP_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(LOCKSTEP_AVX2)  &&  defined(_MSC_VER)
+#include <immintrin.h>
+#endif
+
+
+namespace Lockstep
+{
+#ifdef LOCKSTEP_SSE2
+    // Two registers per batch
+    struct Sse2
+    {
+        enum {N = 16};
+        typedef __m128i Vec;
+
+        static inline Vec load(const uint8_t* p) {return _mm_loadu_si128((const __m128i*)p);}
+        static inline void store(uint8_t* p, Vec v) {_mm_storeu_si128((__m128i*)p, v);}
+        static inline Vec set1(uint8_t x) {return _mm_set1_epi8(char(x));}
+        static inline Vec add(Vec a, Vec b) {return _mm_add_epi8(a, b);}
+        static inline Vec sub(Vec a, Vec b) {return _mm_sub_epi8(a, b);}
+        static inline Vec andv(Vec a, Vec b) {return _mm_and_si128(a, b);}
+        static inline Vec orv(Vec a, Vec b) {return _mm_or_si128(a, b);}
+        static inline Vec xorv(Vec a, Vec b) {return _mm_xor_si128(a, b);}
+        static inline Vec eq(Vec a, Vec b) {return _mm_cmpeq_epi8(a, b);}
+        static inline Vec gt(Vec a, Vec b) {return _mm_cmpgt_epi8(a, b);}
+        static inline Vec blend(Vec a, Vec b, Vec m) {return _mm_or_si128(_mm_andnot_si128(m, a), _mm_and_si128(m, b));}
+        static inline uint32_t bits(Vec m) {return uint32_t(_mm_movemask_epi8(m));}
+        static inline Vec expand(uint32_t bits)
+        {
+            // Byte i of the result is selected from bit i of the mask
+            const Vec select = _mm_set_epi8(char(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, char(0x80), 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+            Vec bytes = _mm_unpacklo_epi64(_mm_set1_epi8(char(bits & 0xFF)), _mm_set1_epi8(char((bits >> 8) & 0xFF)));
+            return _mm_cmpeq_epi8(_mm_and_si128(bytes, select), select);
+        }
+    };
+#endif
+
+
+    int _kernel = LOCKSTEP_KERNEL_SCALAR;
+
+
+    int getKernel(void) {return _kernel;}
+
+    const char* getKernelName(void)
+    {
+        switch(_kernel)
+        {
+            case LOCKSTEP_KERNEL_SSE2: return "SSE2";
+            case LOCKSTEP_KERNEL_AVX2: return "AVX2";
+            default: break;
+        }
+
+        return "scalar";
+    }
+
+
+    bool hasAvx2(void)
+    {
+#ifdef LOCKSTEP_AVX2
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7) return false;
+
+        // AVX and OSXSAVE, then the OS has to be saving the YMM registers
+        __cpuid(info, 1);
+        if((info[2] & (1 << 27)) == 0  ||  (info[2] & (1 << 28)) == 0) return false;
+        if((_xgetbv(0) & 0x06) != 0x06) return false;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+#else
+        return false;
+#endif
+    }
+
+    // Falls back to the best kernel the host supports
+    void setKernel(int kernel)
+    {
+        if(kernel == LOCKSTEP_KERNEL_AVX2  &&  !hasAvx2()) kernel = LOCKSTEP_KERNEL_SSE2;
+#ifndef LOCKSTEP_SSE2
+        if(kernel == LOCKSTEP_KERNEL_SSE2) kernel = LOCKSTEP_KERNEL_SCALAR;
+#endif
+        if(kernel < LOCKSTEP_KERNEL_SCALAR  ||  kernel > LOCKSTEP_KERNEL_AVX2) kernel = LOCKSTEP_KERNEL_SCALAR;
+
+        _kernel = kernel;
+    }
+
+    void initialise(void)
+    {
+        Kernel<Scalar>::initialise();
+#ifdef LOCKSTEP_SSE2
+        Kernel<Sse2>::initialise();
+#endif
+#ifdef LOCKSTEP_AVX2
+        if(hasAvx2()) initialiseAvx2();
+#endif
+
+        setKernel(LOCKSTEP_KERNEL_AVX2);
+    }
+
+    void setLane(Batch& batch, int lane, const Cpu::Machine& machine)
+    {
+        if(lane < 0  ||  lane >= LOCKSTEP_LANES)
+        {
+            fprintf(stderr, "Lockstep::setLane() : lane %d out of range 0 to %d\n", lane, LOCKSTEP_LANES-1);
+            return;
+        }
+
+        State& S = batch._state;
+        const Cpu::State& M = machine._state;
+        S._PCL[lane] = M._PC & 0x00FF;
+        S._PCH[lane] = M._PC >> 8;
+        S._IR[lane] = M._IR;
+        S._D[lane] = M._D;
+        S._AC[lane] = M._AC;
+        S._X[lane] = M._X;
+        S._Y[lane] = M._Y;
+        S._OUT[lane] = M._OUT;
+        S._undef[lane] = M._undef;
+        S._IN[lane] = machine._IN;
+        S._XOUT[lane] = machine._XOUT;
+        for(int i=0; i<RAM_SIZE; i++) batch._RAM[i][lane] = machine._RAM[i];
+
+        // Lanes share the batch's clock
+        batch._clock = machine._clock;
+        if(lane >= batch._lanes) batch._lanes = lane + 1;
+    }
+
+    void getLane(const Batch& batch, int lane, Cpu::Machine& machine)
+    {
+        if(lane < 0  ||  lane >= batch._lanes)
+        {
+            fprintf(stderr, "Lockstep::getLane() : lane %d out of range 0 to %d\n", lane, batch._lanes-1);
+            return;
+        }
+
+        const State& S = batch._state;
+        Cpu::State& M = machine._state;
+        M._PC = (S._PCH[lane] << 8) | S._PCL[lane];
+        M._IR = S._IR[lane];
+        M._D = S._D[lane];
+        M._AC = S._AC[lane];
+        M._X = S._X[lane];
+        M._Y = S._Y[lane];
+        M._OUT = S._OUT[lane];
+        M._undef = S._undef[lane];
+        machine._IN = S._IN[lane];
+        machine._XOUT = S._XOUT[lane];
+        machine._clock = batch._clock;
+        for(int i=0; i<RAM_SIZE; i++) machine._RAM[i] = batch._RAM[i][lane];
+        memset(machine._dirtyPages, DIRTY_PAGE_ALL, sizeof machine._dirtyPages);
+    }
+
+    void execute(Batch& batch, int64_t cycles)
+    {
+        const uint8_t (*rom)[2] = (const uint8_t (*)[2])Cpu::getPtrToROM();
+
+        switch(_kernel)
+        {
+#ifdef LOCKSTEP_AVX2
+            case LOCKSTEP_KERNEL_AVX2: executeAvx2(batch, rom, cycles);         break;
+#endif
+#ifdef LOCKSTEP_SSE2
+            case LOCKSTEP_KERNEL_SSE2: Kernel<Sse2>::execute(batch, rom, cycles); break;
+#endif
+            default: Kernel<Scalar>::execute(batch, rom, cycles); break;
+        }
+    }
+
+    int run(std::vector<Cpu::Machine*>& machines, int64_t cycles, const Input& input)
+    {
+        if(cycles <= 0) return 0;
+
+        // Lanes that don't finish in lockstep are left with the cycles they have done
+        int numMachines = int(machines.size());
+        std::vector<int64_t> done(numMachines, 0);
+        std::atomic<int> fallbacks(0);
+
+        int numBatches = (numMachines + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES;
+        Pool::execute(numBatches, [&](int b)
+        {
+            // A batch is too big for the stack
+            std::vector<Batch> batches(1);
+            Batch& batch = batches[0];
+
+            // Lanes share a clock, a machine on any other clock runs on its own
+            int first = b*LOCKSTEP_LANES;
+            int last = std::min(first + LOCKSTEP_LANES, numMachines);
+            std::vector<int> members;
+            for(int i=first; i<last; i++)
+            {
+                if(machines[i]->_clock != machines[first]->_clock) continue;
+
+                setLane(batch, int(members.size()), *machines[i]);
+                members.push_back(i);
+            }
+
+            int64_t cyclesDone = 0;
+            while(cyclesDone < cycles)
+            {
+                if(input)
+                {
+                    for(int i=0; i<int(members.size()); i++) batch._state._IN[i] = input(members[i], cyclesDone);
+                }
+
+                int64_t chunk = std::min(int64_t(LOCKSTEP_CHUNK_CYCLES), cycles - cyclesDone);
+                uint64_t groups = batch._groups;
+                execute(batch, chunk);
+                cyclesDone += chunk;
+
+                if((batch._groups - groups)*LOCKSTEP_FALLBACK_LANES > uint64_t(chunk)*uint64_t(batch._lanes)) break;
+            }
+
+            for(int i=0; i<int(members.size()); i++)
+            {
+                getLane(batch, i, *machines[members[i]]);
+                done[members[i]] = cyclesDone;
+            }
+
+            if(cyclesDone < cycles) fallbacks++;
+        });
+
+        // Everything that didn't finish in lockstep, chunk by chunk when there is input so that it sees the same IN as a lane would
+        std::vector<int> remaining;
+        for(int i=0; i<numMachines; i++)
+        {
+            if(done[i] < cycles) remaining.push_back(i);
+        }
+
+        Cpu::translateRom();
+        Pool::execute(int(remaining.size()), [&](int r)
+        {
+            int i = remaining[r];
+            Cpu::Machine& machine = *machines[i];
+            Cpu::setMachine(machine);
+            while(done[i] < cycles)
+            {
+                int64_t chunk = (input) ? std::min(int64_t(LOCKSTEP_CHUNK_CYCLES), cycles - done[i]) : cycles - done[i];
+                if(input) machine._IN = input(i, done[i]);
+                Cpu::runMachine(machine, chunk);
+                done[i] += chunk;
+            }
+        });
+
+        return fallbacks;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+
+#include "memory.h"
+#include "timing.h"
+#include "cpu.h"
+
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LOCKSTEP_SSE2
+#define LOCKSTEP_AVX2
+#endif
+
+#define LOCKSTEP_KERNEL_SCALAR  0
+#define LOCKSTEP_KERNEL_SSE2    1
+#define LOCKSTEP_KERNEL_AVX2    2
+
+// Number of machines in a batch, a lane per byte of an AVX2 register
+#define LOCKSTEP_LANES  32
+
+// Lockstep::run() executes a frame at a time and gives up on a batch once a frame averages more than one group per cycle for every
+// LOCKSTEP_FALLBACK_LANES lanes, whatever the number of threads, (measured with AVX2 against the threaded interpreter on one thread,
+// a batch costs about 3 lanes' worth while every lane is in one group and each group beyond that about 8 more, so 32 lanes break even
+// at about 4.5 groups per cycle and 16 at about 2.5)
+#define LOCKSTEP_CHUNK_CYCLES    (SCAN_LINES*HLINE_END)
+#define LOCKSTEP_FALLBACK_LANES  8
+
+
+namespace Lockstep
+{
+    // Cpu::State as a struct of arrays, one byte per lane, PC is split into its two halves so that every register is a byte vector
+    struct State
+    {
+        uint8_t _PCL[LOCKSTEP_LANES], _PCH[LOCKSTEP_LANES];
+        uint8_t _IR[LOCKSTEP_LANES], _D[LOCKSTEP_LANES];
+        uint8_t _AC[LOCKSTEP_LANES], _X[LOCKSTEP_LANES], _Y[LOCKSTEP_LANES], _OUT[LOCKSTEP_LANES], _undef[LOCKSTEP_LANES];
+        uint8_t _IN[LOCKSTEP_LANES], _XOUT[LOCKSTEP_LANES];
+    };
+
+    // Up to LOCKSTEP_LANES machines sharing the ROM and a clock, RAM is interleaved so that a row holds one address for every lane
+    // and an access all lanes agree on is a single vector load or store; _groups counts instruction groups executed, it equals _cycles
+    // while every lane is on the same instruction and grows with every lane that diverges
+    struct Batch
+    {
+        int _lanes = 0;
+        int64_t _clock = CLOCK_RESET;
+        uint64_t _cycles = 0;
+        uint64_t _groups = 0;
+        State _state;
+        uint8_t _RAM[RAM_SIZE][LOCKSTEP_LANES];
+    };
+
+
+    int getKernel(void);
+    const char* getKernelName(void);
+
+    void setKernel(int kernel);
+
+    void initialise(void);
+
+    void setLane(Batch& batch, int lane, const Cpu::Machine& machine);
+    void getLane(const Batch& batch, int lane, Cpu::Machine& machine);
+
+    // Equivalent to Cpu::runMachine() on every lane, including power on reset and the XOUT latch; lanes on the same PC and instruction
+    // execute together, lanes that have branched elsewhere are masked out and run as a group of their own in the same cycle
+    void execute(Batch& batch, int64_t cycles);
+
+    // Gives a machine, (by its index), its IN for the next LOCKSTEP_CHUNK_CYCLES, from the cycles it has run so far
+    typedef std::function<uint8_t(int, int64_t)> Input;
+
+    // Advances every machine by the same number of cycles, LOCKSTEP_LANES at a time through batches that run in parallel on the
+    // Pool's threads; machines whose clocks differ from the first of their batch, and every lane of a batch that diverges past
+    // LOCKSTEP_FALLBACK_LANES, are run one at a time by Cpu::runMachine() instead, again in parallel; input, when given, is asked
+    // for every machine's IN at the start of every chunk whichever way it runs; returns the number of batches that fell back
+    int run(std::vector<Cpu::Machine*>& machines, int64_t cycles, const Input& input=Input());
+}
+
+#endif
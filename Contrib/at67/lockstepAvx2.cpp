@@ -0,0 +1,51 @@
+#include "lockstep.h"
+
+// Only this translation unit is built with AVX2 code generation, Lockstep::initialise() checks the host before anything in here is called
+#ifdef LOCKSTEP_AVX2
+#include <immintrin.h>
+
+#include "lockstepKernel.h"
+
+
+namespace Lockstep
+{
+    // A whole batch in one register
+    struct Avx2
+    {
+        enum {N = 32};
+        typedef __m256i Vec;
+
+        static inline Vec load(const uint8_t* p) {return _mm256_loadu_si256((const __m256i*)p);}
+        static inline void store(uint8_t* p, Vec v) {_mm256_storeu_si256((__m256i*)p, v);}
+        static inline Vec set1(uint8_t x) {return _mm256_set1_epi8(char(x));}
+        static inline Vec add(Vec a, Vec b) {return _mm256_add_epi8(a, b);}
+        static inline Vec sub(Vec a, Vec b) {return _mm256_sub_epi8(a, b);}
+        static inline Vec andv(Vec a, Vec b) {return _mm256_and_si256(a, b);}
+        static inline Vec orv(Vec a, Vec b) {return _mm256_or_si256(a, b);}
+        static inline Vec xorv(Vec a, Vec b) {return _mm256_xor_si256(a, b);}
+        static inline Vec eq(Vec a, Vec b) {return _mm256_cmpeq_epi8(a, b);}
+        static inline Vec gt(Vec a, Vec b) {return _mm256_cmpgt_epi8(a, b);}
+        static inline Vec blend(Vec a, Vec b, Vec m) {return _mm256_blendv_epi8(a, b, m);}
+        static inline uint32_t bits(Vec m) {return uint32_t(_mm256_movemask_epi8(m));}
+        static inline Vec expand(uint32_t bits)
+        {
+            // Broadcast the mask, move byte i/8 of it into byte i, then select bit i%8
+            const Vec shuffle = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+            const Vec select = _mm256_set1_epi64x(int64_t(0x8040201008040201ULL));
+            Vec bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(int(bits)), shuffle);
+            return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, select), select);
+        }
+    };
+
+
+    void initialiseAvx2(void)
+    {
+        Kernel<Avx2>::initialise();
+    }
+
+    void executeAvx2(Batch& batch, const uint8_t (*rom)[2], int64_t cycles)
+    {
+        Kernel<Avx2>::execute(batch, rom, cycles);
+    }
+}
+#endif
@@ -0,0 +1,308 @@
+#ifndef LOCKSTEP_KERNEL_H
+#define LOCKSTEP_KERNEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lockstep.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+// Shared by every instruction set's kernel, each one is compiled in its own translation unit with its own code generation flags, so
+// nothing in here may have external linkage other than the templates themselves, which are instantiated for a different V in each unit
+namespace Lockstep
+{
+    static inline int lowestLane(uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return int(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    namespace
+    {
+        // One lane at a time, used for groups of a single lane and for hosts without any of the vector kernels
+        struct Scalar
+        {
+            enum {N = 1};
+            typedef uint8_t Vec;
+
+            static inline Vec load(const uint8_t* p) {return *p;}
+            static inline void store(uint8_t* p, Vec v) {*p = v;}
+            static inline Vec set1(uint8_t x) {return x;}
+            static inline Vec add(Vec a, Vec b) {return uint8_t(a + b);}
+            static inline Vec sub(Vec a, Vec b) {return uint8_t(a - b);}
+            static inline Vec andv(Vec a, Vec b) {return a & b;}
+            static inline Vec orv(Vec a, Vec b) {return a | b;}
+            static inline Vec xorv(Vec a, Vec b) {return a ^ b;}
+            static inline Vec eq(Vec a, Vec b) {return (a == b) ? 0xFF : 0x00;}
+            static inline Vec gt(Vec a, Vec b) {return (int8_t(a) > int8_t(b)) ? 0xFF : 0x00;}
+            static inline Vec blend(Vec a, Vec b, Vec m) {return m ? b : a;}
+            static inline uint32_t bits(Vec m) {return m >> 7;}
+            static inline Vec expand(uint32_t bits) {return (bits & 1) ? 0xFF : 0x00;}
+        };
+    }
+
+    // V supplies Vec, a vector of N byte lanes, and the handful of byte operations the Gigatron needs: load, store, set1, add, sub, and,
+    // or, xor, eq, gt (signed), blend (b where m is set), bits (a mask per lane) and expand (the inverse of bits)
+    template<class V> struct Kernel
+    {
+        typedef typename V::Vec Vec;
+        typedef void (*Opcode)(Batch& B, const uint8_t (*rom)[2], int leader, uint32_t group);
+
+        static Opcode _opcodes[256];
+
+
+        static inline uint32_t chunkAll(void) {return (V::N == 32) ? 0xFFFFFFFF : (1u << V::N) - 1;}
+        static inline uint32_t chunkBits(uint32_t group, int c) {return (group >> c) & chunkAll();}
+
+        // Lanes whose RAM address disagrees with the rest of the group are accessed one at a time
+        static void gather(Batch& B, int c, uint32_t bits, const uint8_t* lo, const uint8_t* hi, uint8_t* data)
+        {
+            for(int i=0; i<V::N; i++)
+            {
+                if(bits & (1u << i)) data[i] = B._RAM[((hi[i] << 8) | lo[i]) & (RAM_SIZE-1)][c + i];
+            }
+        }
+
+        static void scatter(Batch& B, int c, uint32_t bits, const uint8_t* lo, const uint8_t* hi, const uint8_t* data)
+        {
+            for(int i=0; i<V::N; i++)
+            {
+                if(bits & (1u << i)) B._RAM[((hi[i] << 8) | lo[i]) & (RAM_SIZE-1)][c + i] = data[i];
+            }
+        }
+
+        // Every lane of the group has the same PC, IR and D as the leader, so decode, fetch and the next PC are scalar and only the data is per lane
+        template<uint8_t IR> static void opcode(Batch& B, const uint8_t (*rom)[2], int leader, uint32_t group)
+        {
+            const int ins = IR >> 5;       // Instruction
+            const int mod = (IR >> 2) & 7; // Addressing mode (or condition)
+            const int bus = IR & 3;        // Busmode
+            const int W = (ins == 6);      // Write instruction?
+            const int J = (ins == 7);      // Jump instruction?
+
+            const bool useX = !J  &&  (mod == 1  ||  mod == 3  ||  mod == 7);
+            const bool useY = !J  &&  (mod == 2  ||  mod == 3  ||  mod == 7);
+            const bool useRAM = (bus == 1)  ||  W;
+
+            State& S = B._state;
+            const uint8_t D = S._D[leader];
+            const uint16_t PC = (S._PCH[leader] << 8) | S._PCL[leader];
+            const uint16_t next = PC + 1;
+            const Vec fetchIR = V::set1(rom[PC][ROM_INST]);
+            const Vec fetchD  = V::set1(rom[PC][ROM_DATA]);
+
+            for(uint32_t chunks=group; chunks; )
+            {
+                const int c = lowestLane(chunks) & ~(V::N-1);
+                const uint32_t bits = chunkBits(group, c);
+                chunks &= ~(chunkAll() << c);
+
+                const Vec m = (bits == chunkAll()) ? V::set1(0xFF) : V::expand(bits);
+                const Vec AC = V::load(&S._AC[c]);
+                const Vec X = V::load(&S._X[c]);
+                const Vec Y = V::load(&S._Y[c]);
+
+                // Mode Decoder, a single RAM row when every lane of the group agrees on X and Y
+                uint8_t lo = D, hi = 0;
+                bool uniform = true;
+                if(useRAM)
+                {
+                    int first = c + lowestLane(bits);
+                    if(useX) {lo = S._X[first]; uniform = uniform  &&  (V::bits(V::eq(X, V::set1(lo))) & bits) == bits;}
+                    if(useY) {hi = S._Y[first]; uniform = uniform  &&  (V::bits(V::eq(Y, V::set1(hi))) & bits) == bits;}
+                }
+                uint8_t* row = &B._RAM[((hi << 8) | lo) & (RAM_SIZE-1)][c];
+
+                uint8_t los[V::N], his[V::N], data[V::N];
+                if(!uniform)
+                {
+                    for(int i=0; i<V::N; i++)
+                    {
+                        los[i] = useX ? S._X[c + i] : D;
+                        his[i] = useY ? S._Y[c + i] : 0;
+                    }
+                }
+
+                Vec Bus = V::load(&S._undef[c]); // Data Bus
+                switch(bus)
+                {
+                    case 0: Bus = V::set1(D); break;
+                    case 1:
+                    {
+                        if(!W)
+                        {
+                            if(uniform) Bus = V::load(row);
+                            else {gather(B, c, bits, los, his, data); Bus = V::blend(Bus, V::load(data), m);}
+                        }
+                    }
+                    break;
+                    case 2: Bus = AC;                   break;
+                    case 3: Bus = V::load(&S._IN[c]);   break;
+                }
+
+                // Random Access Memory
+                if(W)
+                {
+                    if(uniform) V::store(row, V::blend(V::load(row), Bus, m));
+                    else {V::store(data, Bus); scatter(B, c, bits, los, his, data);}
+                }
+
+                Vec ALU = AC; // Arithmetic and Logic Unit
+                switch(ins)
+                {
+                    case 0: ALU = Bus;                              break; // LD
+                    case 1: ALU = V::andv(AC, Bus);                 break; // ANDA
+                    case 2: ALU = V::orv(AC, Bus);                  break; // ORA
+                    case 3: ALU = V::xorv(AC, Bus);                 break; // XORA
+                    case 4: ALU = V::add(AC, Bus);                  break; // ADDA
+                    case 5: ALU = V::sub(AC, Bus);                  break; // SUBA
+                    case 6: ALU = AC;                               break; // ST
+                    case 7: ALU = V::sub(V::set1(0), AC);           break; // Bcc/JMP
+                }
+
+                // Load value into register, AC and OUT loading are disabled during RAM write
+                if(!J)
+                {
+                    const bool out = (mod == 6  ||  mod == 7)  &&  !W;
+                    switch(mod)
+                    {
+                        case 0: case 1: case 2: case 3: if(!W) V::store(&S._AC[c], V::blend(AC, ALU, m)); break;
+                        case 4:                         V::store(&S._X[c], V::blend(X, ALU, m));          break;
+                        case 5:                         V::store(&S._Y[c], V::blend(Y, ALU, m));          break;
+                        case 7:                         V::store(&S._X[c], V::blend(X, V::add(X, V::set1(1)), m)); break; // Increment X
+                        default: break;
+                    }
+
+                    // XOUT is latched from AC on the rising edge of hSync
+                    if(out)
+                    {
+                        Vec OUT = V::load(&S._OUT[c]);
+                        Vec OUTnew = V::blend(OUT, ALU, m);
+                        Vec hSync = V::set1(0x40);
+                        Vec rising = V::eq(V::andv(V::andv(V::xorv(OUT, V::set1(0xFF)), OUTnew), hSync), hSync);
+                        V::store(&S._OUT[c], OUTnew);
+                        V::store(&S._XOUT[c], V::blend(V::load(&S._XOUT[c]), AC, rising));
+                    }
+                }
+
+                // Next instruction
+                Vec PCL = V::set1(uint8_t(next & 0x00FF));
+                Vec PCH = V::set1(uint8_t(next >> 8));
+                if(J)
+                {
+                    if(mod != 0) // Conditional branch within page
+                    {
+                        Vec zero = V::set1(0);
+                        Vec taken = zero;
+                        if(mod & 1) taken = V::orv(taken, V::gt(AC, zero));  // AC > 0
+                        if(mod & 2) taken = V::orv(taken, V::gt(zero, AC));  // AC < 0
+                        if(mod & 4) taken = V::orv(taken, V::eq(AC, zero));  // AC == 0
+                        PCL = V::blend(PCL, Bus, taken);
+                        PCH = V::blend(PCH, V::set1(uint8_t(PC >> 8)), taken);
+                    }
+                    else
+                    {
+                        PCL = Bus; // Unconditional far jump
+                        PCH = Y;
+                    }
+                }
+                V::store(&S._PCL[c], V::blend(V::load(&S._PCL[c]), PCL, m));
+                V::store(&S._PCH[c], V::blend(V::load(&S._PCH[c]), PCH, m));
+
+                // Instruction Fetch
+                V::store(&S._IR[c], V::blend(V::load(&S._IR[c]), fetchIR, m));
+                V::store(&S._D[c], V::blend(V::load(&S._D[c]), fetchD, m));
+            }
+        }
+
+        // Lanes that execute the same instruction as the leader this cycle
+        static uint32_t sameAs(const State& S, int leader)
+        {
+            const Vec pcl = V::set1(S._PCL[leader]), pch = V::set1(S._PCH[leader]);
+            const Vec ir = V::set1(S._IR[leader]), d = V::set1(S._D[leader]);
+
+            uint32_t same = 0;
+            for(int c=0; c<LOCKSTEP_LANES; c+=V::N)
+            {
+                Vec eq = V::andv(V::andv(V::eq(V::load(&S._PCL[c]), pcl), V::eq(V::load(&S._PCH[c]), pch)),
+                                 V::andv(V::eq(V::load(&S._IR[c]), ir), V::eq(V::load(&S._D[c]), d)));
+                same |= V::bits(eq) << c;
+            }
+
+            return same;
+        }
+
+        static void initialise(void);
+
+        static void execute(Batch& B, const uint8_t (*rom)[2], int64_t cycles)
+        {
+            State& S = B._state;
+            const uint32_t lanes = (B._lanes >= 32) ? 0xFFFFFFFF : (1u << B._lanes) - 1;
+            if(lanes == 0) return;
+
+            for(int64_t i=0; i<cycles; i++)
+            {
+                // MCP100 Power-On Reset
+                if(B._clock < 0)
+                {
+                    memset(S._PCL, 0, LOCKSTEP_LANES);
+                    memset(S._PCH, 0, LOCKSTEP_LANES);
+                }
+
+                uint32_t pending = lanes;
+                while(pending)
+                {
+                    int leader = lowestLane(pending);
+                    uint32_t group = sameAs(S, leader) & pending;
+                    if(group & (group - 1))
+                    {
+                        _opcodes[S._IR[leader]](B, rom, leader, group);
+                    }
+                    else
+                    {
+                        Kernel<Scalar>::_opcodes[S._IR[leader]](B, rom, leader, group);
+                    }
+                    pending &= ~group;
+                    B._groups++;
+                }
+
+                B._clock++;
+                B._cycles++;
+            }
+        }
+    };
+
+    template<class V> typename Kernel<V>::Opcode Kernel<V>::_opcodes[256];
+
+    template<class V, int N> struct OpcodeTable
+    {
+        static void initialise(void) {OpcodeTable<V, N-1>::initialise(); Kernel<V>::_opcodes[N-1] = Kernel<V>::template opcode<N-1>;}
+    };
+    template<class V> struct OpcodeTable<V, 0>
+    {
+        static void initialise(void) {}
+    };
+
+    template<class V> void Kernel<V>::initialise(void)
+    {
+        OpcodeTable<V, 256>::initialise();
+        OpcodeTable<Scalar, 256>::initialise();
+    }
+
+
+#ifdef LOCKSTEP_AVX2
+    void initialiseAvx2(void);
+    void executeAvx2(Batch& batch, const uint8_t (*rom)[2], int64_t cycles);
+#endif
+}
+
+#endif
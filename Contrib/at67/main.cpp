@@ -7,11 +7,20 @@
 /**********************************************************************************************/
 
 
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
 #include "memory.h"
 #include "cpu.h"
+#include "vcpu.h"
 #include "audio.h"
 #include "editor.h"
 #include "loader.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "capture.h"
+#include "analyser.h"
 #include "timing.h"
 #include "graphics.h"
 #include "expression.h"
@@ -19,23 +28,11 @@
 #include "compiler.h"
 
 
-int main(int argc, char* argv[])
+// Everything that touches the machine, including the editor and the composition of frames, runs here, returns on the first frame
+// after the window is closed
+void emulate(void)
 {
-    Cpu::State S;
-
-    Cpu::initialise(S);
-    Memory::intitialise();
-    Audio::initialise();
-    Graphics::initialise();
-    Editor::initialise();
-    Loader::initialise();
-    Expression::initialise();
-    Assembler::initialise();
-    Compiler::initialise();
-
-
-    //Compiler::compile("gbas/test.gbas", "gbas/test.gasm");
-
+    Cpu::State& S = Cpu::getMainMachine()._state;
 
     bool debugging = false;
 
@@ -43,6 +40,14 @@ int main(int argc, char* argv[])
     int HSync = 0, VSync = 0;
     int64_t clock_prev = CLOCK_RESET;
 
+    // OUT of every visible cycle of the current line, converted to pixels a whole line at a time
+    uint8_t scanline[HPIXELS_END-HPIXELS_START];
+    int scanlineLength = 0;
+
+    // Everything that needs handling between cycles is on an OUT transition
+    Cpu::EventSink sink;
+    sink._events = Cpu::EventOut | Cpu::EventHSync | Cpu::EventVSync | (Cpu::getBurstMode() ? Cpu::EventBurst : 0);
+
     for(;;)
     {
         int64_t clock = Cpu::getClock();
@@ -50,8 +55,12 @@ int main(int argc, char* argv[])
         // MCP100 Power-On Reset
         if(clock < 0) S._PC = 0; 
 
-        // Update CPU
-        Cpu::State T = Cpu::cycle(S);
+        // Update CPU, runs until OUT changes, (which only ever happens on the last cycle), or a whole line when nothing does; timing
+        // analysis needs to see every instruction so it runs a cycle at a time
+        bool analysing = Analyser::getAnalysing();
+        Cpu::State T = S;
+        int64_t cycles = Cpu::run(T, (clock < 0  ||  debugging  ||  analysing) ? 1 : HLINE_END, sink);
+        if(analysing) Analyser::cycle(S, T, clock);
 
         HSync = (T._OUT & 0x40) - (S._OUT & 0x40);
         VSync = (T._OUT & 0x80) - (S._OUT & 0x80);
@@ -59,9 +68,19 @@ int main(int argc, char* argv[])
         // Falling vSync edge
         if(VSync < 0)
         {
+            if(Editor::getQuitting()) return;
+
             clock_prev = clock;
+
+            // Whatever was drawn of a line that never saw hSync
+            Capture::captureScanline(scanline, scanlineLength, vgaY);
+            Graphics::refreshScanline(scanline, scanlineLength, vgaY, debugging);
+            scanlineLength = 0;
             vgaY = VSYNC_START;
 
+            // Music, one frame of the score per emulated frame
+            Audio::playMusic();
+
             // Input and graphics
             if(!debugging)
             {
@@ -72,17 +91,37 @@ int main(int argc, char* argv[])
                 Graphics::render();
                 if(clock > 10000000) Graphics::tetris();
 #endif
+                // Save and load requests, a restored machine resumes on this same vSync edge
+                if(Snapshot::update(T))
+                {
+                    clock_prev = Cpu::getClock();
+                    Analyser::resync();
+                }
             }
+
+            // Rewind history, one checkpoint per frame
+            Rewind::checkpoint(T);
+
+            // Video capture, hands the finished frame to the writer thread
+            Capture::endFrame();
         }
 
-        // Pixel
-        if(vgaX++ < HLINE_END)
+        // Pixels, OUT only ever changes on the last cycle of a run so every cycle of it output S._OUT
+        if(vgaY >= 0  &&  vgaY < SCREEN_HEIGHT)
         {
-            if(vgaY >= 0  &&  vgaY < SCREEN_HEIGHT  &&  vgaX >=HPIXELS_START  &&  vgaX < HPIXELS_END)
+            int first = std::max(vgaX + 1, HPIXELS_START);
+            int last = int(std::min(int64_t(vgaX) + cycles, int64_t(HPIXELS_END - 1)));
+            if(first <= last)
             {
-                Graphics::refreshPixel(S, vgaX-HPIXELS_START, vgaY, debugging);
+                // A pixel burst took the last cycles of the run and brings its own OUT for each of them
+                int burstX = (sink._event & Cpu::EventBurst) ? vgaX + int(cycles) - sink._burstLength + 1 : last + 1;
+                int middle = std::min(std::max(burstX, first), last + 1);
+                if(middle > first) memset(&scanline[first - HPIXELS_START], S._OUT, middle - first);
+                if(middle <= last) memcpy(&scanline[middle - HPIXELS_START], &sink._burst[middle - burstX], last - middle + 1);
+                scanlineLength = last - HPIXELS_START + 1;
             }
         }
+        vgaX += int(cycles);
 
         // Watchdog
         if(!debugging  &&  clock > STARTUP_DELAY_CLOCKS  &&  clock - clock_prev > CPU_STALL_CLOCKS)
@@ -91,6 +130,8 @@ int main(int argc, char* argv[])
             Cpu::reset(true);
             vgaX = 0, vgaY = 0;
             HSync = 0, VSync = 0;
+            scanlineLength = 0;
+            Analyser::resync();
             fprintf(stderr, "main(): CPU stall for %" PRId64 " clocks : rebooting.\n", clock - clock_prev);
         }
 
@@ -118,6 +159,9 @@ int main(int argc, char* argv[])
                 if((vgaY % 4) == 3) Graphics::refreshTimingPixel(S, 160, (vgaY/4) % GIGA_HEIGHT, colour, debugging);
             }
 
+            Capture::captureScanline(scanline, scanlineLength, vgaY);
+            Graphics::refreshScanline(scanline, scanlineLength, vgaY, debugging);
+            scanlineLength = 0;
             vgaX = 0;
             vgaY++;
 
@@ -128,19 +172,57 @@ int main(int argc, char* argv[])
         // Debugger
         debugging = Editor::singleStepDebug();
 
-        // vCPU instruction slot utilisation
-        Cpu::vCpuUsage(S);
-        
-#if 0
-        Audio::playMusic();
-#endif
-
-        // Master clock
-        clock = Cpu::getClock();
-        Cpu::setClock(++clock);
+        // Scrubbed in the debugger, the machine continues from the checkpoint's falling vSync edge
+        if(Rewind::update(T))
+        {
+            clock_prev = Cpu::getClock();
+            vgaX = 0, vgaY = VSYNC_START;
+            scanlineLength = 0;
+            Analyser::resync();
+        }
 
         S=T;
     }
+}
+
+
+int main(int argc, char* argv[])
+{
+    Cpu::initialise(Cpu::getMainMachine()._state);
+    Vcpu::initialise();
+    Memory::intitialise();
+    Audio::initialise();
+    Graphics::initialise();
+    Editor::initialise();
+    Loader::initialise();
+    Expression::initialise();
+    Assembler::initialise();
+    Compiler::initialise();
+    Snapshot::initialise();
+    Rewind::initialise();
+
+
+    //Compiler::compile("gbas/test.gbas", "gbas/test.gasm");
+
+
+#ifdef EMULATION_THREAD
+    // This thread keeps SDL, a slow present or driver stall only ever delays the frames on screen, never the machine or its audio
+    std::thread emulation(emulate);
+
+    while(Editor::queueEvents())
+    {
+        if(!Graphics::presentFrame()) SDL_Delay(1);
+    }
+
+    // Nothing the emulation thread uses can be stopped or destroyed while it is still running, the capture writer then finishes
+    // whatever it has queued and the timing report is written
+    emulation.join();
+    Capture::stop();
+    Analyser::stop();
+    SDL_Quit();
+#else
+    emulate();
+#endif
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "cpu.h"
+#include "pool.h"
+
+
+namespace Pool
+{
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _start;
+    std::condition_variable _finish;
+
+    // Current job, _generation changes whenever a new one is posted
+    const std::function<void(int)>* _job = NULL;
+    size_t _numJobs = 0;
+    uint64_t _generation = 0;
+    std::atomic<size_t> _next(0);
+    int _running = 0;
+    bool _shutdown = false;
+
+
+    int getNumThreads(void) {return int(_threads.size());}
+
+
+    // Workers start from the generation current when they were created, so that one started after earlier runs waits for the next
+    void worker(uint64_t generation)
+    {
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _start.wait(lock, [&generation]{return _shutdown  ||  _generation != generation;});
+                if(_shutdown) return;
+                generation = _generation;
+            }
+
+            for(size_t i=_next++; i<_numJobs; i=_next++) (*_job)(int(i));
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(--_running == 0) _finish.notify_one();
+        }
+    }
+
+    void initialise(int numThreads)
+    {
+        if(_threads.size()) shutdown();
+
+        if(numThreads <= 0) numThreads = int(std::thread::hardware_concurrency());
+        if(numThreads <= 0) numThreads = 1;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _shutdown = false;
+        for(int i=0; i<numThreads; i++) _threads.push_back(std::thread(worker, _generation));
+    }
+
+    void shutdown(void)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _shutdown = true;
+        }
+        _start.notify_all();
+
+        for(int i=0; i<int(_threads.size()); i++) _threads[i].join();
+        _threads.clear();
+    }
+
+    void execute(int numJobs, const std::function<void(int)>& job)
+    {
+        if(numJobs <= 0) return;
+
+        if(_threads.empty()) initialise();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _job = &job;
+        _numJobs = size_t(numJobs);
+        _next = 0;
+        _running = int(_threads.size());
+        _generation++;
+        _start.notify_all();
+
+        _finish.wait(lock, []{return _running == 0;});
+        _job = NULL;
+    }
+
+    void run(std::vector<Cpu::Machine*>& machines, int64_t cycles)
+    {
+        if(machines.empty()  ||  cycles <= 0) return;
+
+        // The translation cache is shared, so it has to be complete before any worker touches it
+        Cpu::translateRom();
+
+        execute(int(machines.size()), [&machines, cycles](int i)
+        {
+            Cpu::Machine& machine = *machines[i];
+            Cpu::setMachine(machine);
+            Cpu::runMachine(machine, cycles);
+        });
+    }
+}
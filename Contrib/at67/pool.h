@@ -0,0 +1,27 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+
+#include "cpu.h"
+
+
+namespace Pool
+{
+    int getNumThreads(void);
+
+    void initialise(int numThreads=0);
+    void shutdown(void);
+
+    // Advances every machine by the same number of cycles with Cpu::runMachine(), machines are handed out one at a time to whichever
+    // thread is free and become that thread's current machine while it runs them; returns once every machine is done
+    void run(std::vector<Cpu::Machine*>& machines, int64_t cycles);
+
+    // Calls job() once for every index from 0 to numJobs-1, handed out the same way, returns once every job is done; jobs that run
+    // machines have to make them current themselves and the translation cache has to be complete, (Cpu::translateRom())
+    void execute(int numJobs, const std::function<void(int)>& job);
+}
+
+#endif
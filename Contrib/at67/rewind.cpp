@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "memory.h"
+#include "cpu.h"
+#include "audio.h"
+#include "loader.h"
+#include "rewind.h"
+
+
+#define REWIND_PAGE_SIZE 256
+
+
+namespace Rewind
+{
+    // Checkpoints are a ring, oldest first, their pages are allocated in the same order from a ring of page slots
+    std::vector<Checkpoint> _checkpoints;
+    int _maxFrames = 0;
+    int _firstFrame = 0;
+    int _numFrames = 0;
+
+    std::vector<uint8_t> _slots;
+    std::vector<uint8_t> _slotPages;
+    uint32_t _numSlots = 0;
+    uint32_t _slotHead = 0;
+    uint32_t _slotsUsed = 0;
+
+    // RAM as it was at the checkpoint the machine is on, so that a dirty page's old contents are still around when the next one is taken
+    uint8_t _shadowRAM[RAM_SIZE];
+
+    size_t _memoryBudget = 0;
+
+    bool _rewinding = false;
+    int _position = 0;
+
+    bool _updated = false;
+    Cpu::State _state;
+
+
+    int getNumFrames(void) {return _numFrames;}
+    int getPosition(void) {return _rewinding ? _position : 0;}
+    size_t getMemoryUsed(void) {return _numFrames*sizeof(Checkpoint) + _slotsUsed*(REWIND_PAGE_SIZE + 1) + RAM_SIZE;}
+    size_t getMemoryBudget(void) {return _memoryBudget;}
+
+
+    Checkpoint& getFrame(int frame) {return _checkpoints[(_firstFrame + frame) % _maxFrames];}
+    uint8_t* getSlot(uint32_t slot) {return &_slots[(slot % _numSlots) * REWIND_PAGE_SIZE];}
+
+    void reset(void)
+    {
+        _firstFrame = 0;
+        _numFrames = 0;
+        _slotHead = 0;
+        _slotsUsed = 0;
+        _rewinding = false;
+        _position = 0;
+        _updated = false;
+
+        memcpy(_shadowRAM, Cpu::getPtrToRAM(), RAM_SIZE);
+        Cpu::clearDirtyPages(DIRTY_PAGE_REWIND);
+    }
+
+    void initialise(int seconds, int megabytes)
+    {
+        _maxFrames = (seconds > 0) ? seconds * 60 : 1;
+        _memoryBudget = size_t(megabytes) << 20;
+
+        // Whatever is left after the checkpoints and the shadow RAM goes to page slots, there must be room for at least one whole RAM
+        size_t fixed = _maxFrames*sizeof(Checkpoint) + RAM_SIZE;
+        size_t slots = (_memoryBudget > fixed) ? (_memoryBudget - fixed) / (REWIND_PAGE_SIZE + 1) : 0;
+        if(slots < RAM_DIRTY_PAGES)
+        {
+            fprintf(stderr, "Rewind::initialise() : budget of %d MB is too small for %d seconds, using %d KB of pages\n", megabytes, seconds, (RAM_DIRTY_PAGES*(REWIND_PAGE_SIZE + 1)) >> 10);
+            slots = RAM_DIRTY_PAGES;
+        }
+
+        _numSlots = uint32_t(slots);
+        _checkpoints.resize(_maxFrames);
+        _slots.resize(slots * REWIND_PAGE_SIZE);
+        _slotPages.resize(slots);
+
+        reset();
+    }
+
+
+    void dropOldest(void)
+    {
+        _slotsUsed -= getFrame(0)._numPages;
+        _firstFrame = (_firstFrame + 1) % _maxFrames;
+        _numFrames--;
+    }
+
+    void dropNewest(void)
+    {
+        uint16_t numPages = getFrame(_numFrames - 1)._numPages;
+        _slotHead = (_slotHead + _numSlots - numPages) % _numSlots;
+        _slotsUsed -= numPages;
+        _numFrames--;
+    }
+
+    void checkpoint(const Cpu::State& S)
+    {
+        if(_maxFrames == 0) return;
+
+        Cpu::Machine& machine = Cpu::getMachine();
+        uint8_t* dirtyPages = machine._dirtyPages;
+
+        // Execution has resumed from a scrubbed position, so the frames after it no longer happened
+        if(_rewinding)
+        {
+            for(; _position > 0; _position--) dropNewest();
+            _rewinding = false;
+        }
+
+#ifdef REWIND_SELFCHECK
+        for(int p=0; p<RAM_DIRTY_PAGES; p++)
+        {
+            if(!(dirtyPages[p] & DIRTY_PAGE_REWIND)  &&  memcmp(&_shadowRAM[p * REWIND_PAGE_SIZE], &machine._RAM[p * REWIND_PAGE_SIZE], REWIND_PAGE_SIZE))
+            {
+                fprintf(stderr, "Rewind::checkpoint() : RAM page 0x%02x changed without being marked dirty\n", p);
+            }
+        }
+#endif
+
+        uint32_t numPages = 0;
+        for(int p=0; p<RAM_DIRTY_PAGES; p++) numPages += (dirtyPages[p] & DIRTY_PAGE_REWIND) ? 1 : 0;
+        while(_numFrames  &&  (_numFrames == _maxFrames  ||  _slotsUsed + numPages > _numSlots)) dropOldest();
+
+        Checkpoint& checkpoint = getFrame(_numFrames++);
+        checkpoint._state = S;
+        checkpoint._clock = machine._clock;
+        checkpoint._IN = machine._IN;
+        checkpoint._XOUT = machine._XOUT;
+        Audio::getMusicState(checkpoint._musicState);
+        Loader::getUploadState(checkpoint._uploadState);
+        checkpoint._firstSlot = _slotHead;
+        checkpoint._numPages = uint16_t(numPages);
+
+        // Old contents go into the ring, new contents into the shadow
+        for(int p=0; p<RAM_DIRTY_PAGES; p++)
+        {
+            if(!(dirtyPages[p] & DIRTY_PAGE_REWIND)) continue;
+
+            uint8_t* shadow = &_shadowRAM[p * REWIND_PAGE_SIZE];
+            memcpy(getSlot(_slotHead), shadow, REWIND_PAGE_SIZE);
+            memcpy(shadow, &machine._RAM[p * REWIND_PAGE_SIZE], REWIND_PAGE_SIZE);
+            _slotPages[_slotHead] = uint8_t(p);
+            _slotHead = (_slotHead + 1) % _numSlots;
+        }
+        _slotsUsed += numPages;
+
+        Cpu::clearDirtyPages(DIRTY_PAGE_REWIND);
+    }
+
+
+    // Exchanges a checkpoint's pages with RAM, which turns undo pages into redo pages and back again, other trackers see them as dirty
+    void swapPages(const Checkpoint& checkpoint)
+    {
+        Cpu::Machine& machine = Cpu::getMachine();
+        uint8_t* ram = machine._RAM;
+        for(uint32_t i=0; i<checkpoint._numPages; i++)
+        {
+            uint32_t slot = (checkpoint._firstSlot + i) % _numSlots;
+            int page = _slotPages[slot] * REWIND_PAGE_SIZE;
+            uint8_t* data = getSlot(slot);
+
+            uint8_t temp[REWIND_PAGE_SIZE];
+            memcpy(temp, &ram[page], REWIND_PAGE_SIZE);
+            memcpy(&ram[page], data, REWIND_PAGE_SIZE);
+            memcpy(data, temp, REWIND_PAGE_SIZE);
+            memcpy(&_shadowRAM[page], &ram[page], REWIND_PAGE_SIZE);
+            machine._dirtyPages[_slotPages[slot]] |= uint8_t(~DIRTY_PAGE_REWIND);
+        }
+    }
+
+    // Anything written since the machine was last on a checkpoint is put back first
+    void revertDirtyPages(void)
+    {
+        Cpu::Machine& machine = Cpu::getMachine();
+        for(int p=0; p<RAM_DIRTY_PAGES; p++)
+        {
+            if(!(machine._dirtyPages[p] & DIRTY_PAGE_REWIND)) continue;
+
+            memcpy(&machine._RAM[p * REWIND_PAGE_SIZE], &_shadowRAM[p * REWIND_PAGE_SIZE], REWIND_PAGE_SIZE);
+            machine._dirtyPages[p] |= uint8_t(~DIRTY_PAGE_REWIND);
+        }
+        Cpu::clearDirtyPages(DIRTY_PAGE_REWIND);
+
+        if(!_rewinding)
+        {
+            _rewinding = true;
+            _position = 0;
+        }
+    }
+
+    void restoreFrame(void)
+    {
+        const Checkpoint& checkpoint = getFrame(_numFrames - 1 - _position);
+        Cpu::Machine& machine = Cpu::getMachine();
+        machine._clock = checkpoint._clock;
+        machine._IN = checkpoint._IN;
+        machine._XOUT = checkpoint._XOUT;
+        Audio::setMusicState(checkpoint._musicState);
+        Loader::setUploadState(checkpoint._uploadState);
+
+        _state = checkpoint._state;
+        _updated = true;
+    }
+
+    int stepBack(int frames)
+    {
+        if(_numFrames == 0) return 0;
+
+        revertDirtyPages();
+
+        // The oldest checkpoint's pages lead to a frame whose CPU state is gone
+        int moved = 0;
+        for(; moved<frames  &&  _position < _numFrames - 1; moved++)
+        {
+            swapPages(getFrame(_numFrames - 1 - _position));
+            _position++;
+        }
+
+        restoreFrame();
+        return moved;
+    }
+
+    int stepForward(int frames)
+    {
+        if(_numFrames == 0) return 0;
+
+        revertDirtyPages();
+
+        int moved = 0;
+        for(; moved<frames  &&  _position > 0; moved++)
+        {
+            _position--;
+            swapPages(getFrame(_numFrames - 1 - _position));
+        }
+
+        restoreFrame();
+        return moved;
+    }
+
+    bool update(Cpu::State& S)
+    {
+        if(!_updated) return false;
+
+        S = _state;
+        _updated = false;
+        return true;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "audio.h"
+#include "loader.h"
+
+
+// History is bounded by whichever runs out first, a checkpoint is taken every frame
+#define REWIND_SECONDS      60
+#define REWIND_MEGABYTES    32
+#define REWIND_STEP_FRAMES  60
+
+// Use this to check at every checkpoint that no RAM page changed without being marked dirty
+//#define REWIND_SELFCHECK
+
+
+namespace Rewind
+{
+    // The machine as it was at a falling vSync edge, plus the RAM pages that were dirtied between the previous checkpoint and this one;
+    // in the ring the pages hold their contents at the previous checkpoint, (undo), scrubbing swaps them with RAM so once stepped back
+    // over they hold their contents at this checkpoint, (redo)
+    struct Checkpoint
+    {
+        Cpu::State _state;
+        int64_t _clock;
+        uint8_t _IN, _XOUT;
+        Audio::MusicState _musicState;
+        Loader::UploadState _uploadState;
+
+        uint32_t _firstSlot;
+        uint16_t _numPages;
+    };
+
+
+    int getNumFrames(void);
+    int getPosition(void);
+    size_t getMemoryUsed(void);
+    size_t getMemoryBudget(void);
+
+    void initialise(int seconds=REWIND_SECONDS, int megabytes=REWIND_MEGABYTES);
+    void reset(void);
+
+    // main() calls this on every falling vSync edge, if the history was scrubbed everything after the current position is dropped first
+    void checkpoint(const Cpu::State& S);
+
+    // Debugger scrubbing, RAM follows immediately so that the paused screen shows the frame, returns the number of frames actually moved
+    int stepBack(int frames);
+    int stepForward(int frames);
+
+    // Hands the scrubbed CPU state back to main(), returns true once after any step
+    bool update(Cpu::State& S);
+}
+
+#endif
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+
+#include "memory.h"
+#include "cpu.h"
+#include "audio.h"
+#include "loader.h"
+#include "snapshot.h"
+#include "codec.h"
+
+
+namespace Snapshot
+{
+    Request _request = None;
+
+    uint8_t _baseRAM[RAM_SIZE] = {0};
+    uint8_t _baseROM[ROM_SIZE*2] = {0};
+    uint64_t _baseRamHash = 0;
+    uint64_t _baseRomHash = 0;
+
+
+    Request getRequest(void) {return _request;}
+    uint64_t getBaseRamHash(void) {return _baseRamHash;}
+    uint64_t getBaseRomHash(void) {return _baseRomHash;}
+
+    void setRequest(Request request) {_request = request;}
+
+
+    // FNV-1a
+    uint64_t hash(const uint8_t* data, int length)
+    {
+        uint64_t result = 0xCBF29CE484222325ULL;
+        for(int i=0; i<length; i++) result = (result ^ data[i]) * 0x00000100000001B3ULL;
+        return result;
+    }
+
+    void setBaseRAM(const uint8_t* ram)
+    {
+        if(ram) memcpy(_baseRAM, ram, RAM_SIZE);
+        else memset(_baseRAM, 0, RAM_SIZE);
+        _baseRamHash = hash(_baseRAM, RAM_SIZE);
+    }
+
+    void initialise(void)
+    {
+        memcpy(_baseROM, Cpu::getPtrToROM(), ROM_SIZE*2);
+        _baseRomHash = hash(_baseROM, ROM_SIZE*2);
+        setBaseRAM(NULL);
+    }
+
+
+    void capture(State& snapshot, const Cpu::State& S)
+    {
+        const Cpu::Machine& machine = Cpu::getMachine();
+        snapshot._state = S;
+        snapshot._clock = machine._clock;
+        snapshot._IN = machine._IN;
+        snapshot._XOUT = machine._XOUT;
+        Audio::getMusicState(snapshot._musicState);
+        Loader::getUploadState(snapshot._uploadState);
+
+        snapshot._baseRamHash = _baseRamHash;
+        snapshot._baseRomHash = _baseRomHash;
+
+        snapshot._numRamPages = 0;
+        snapshot._ramPages.clear();
+        for(int p=0; p<SNAPSHOT_RAM_PAGES; p++)
+        {
+            const uint8_t* ram = &machine._RAM[p * SNAPSHOT_PAGE_SIZE];
+            const uint8_t* base = &_baseRAM[p * SNAPSHOT_PAGE_SIZE];
+            if(memcmp(ram, base, SNAPSHOT_PAGE_SIZE) == 0) continue;
+
+            Codec::encodeDelta(p, ram, base, SNAPSHOT_PAGE_SIZE, snapshot._ramPages);
+            snapshot._numRamPages++;
+        }
+
+        // Patched ROM pages, instruction and data bytes are interleaved so a page is contiguous
+        const uint8_t* rom = Cpu::getPtrToROM();
+        snapshot._numRomPages = 0;
+        snapshot._romPages.clear();
+        for(int p=0; p<SNAPSHOT_ROM_PAGES; p++)
+        {
+            const uint8_t* page = &rom[p * SNAPSHOT_ROM_PAGE_SIZE];
+            const uint8_t* base = &_baseROM[p * SNAPSHOT_ROM_PAGE_SIZE];
+            if(memcmp(page, base, SNAPSHOT_ROM_PAGE_SIZE) == 0) continue;
+
+            Codec::encodeDelta(p, page, base, SNAPSHOT_ROM_PAGE_SIZE, snapshot._romPages);
+            snapshot._numRomPages++;
+        }
+    }
+
+    bool restore(const State& snapshot, Cpu::State& S)
+    {
+        if(snapshot._baseRamHash != _baseRamHash  ||  snapshot._baseRomHash != _baseRomHash)
+        {
+            fprintf(stderr, "Snapshot::restore() : snapshot was taken against a different base RAM or ROM image\n");
+            return false;
+        }
+
+        static uint8_t ram[RAM_SIZE];
+        static uint8_t rom[ROM_SIZE*2];
+        memcpy(ram, _baseRAM, RAM_SIZE);
+        memcpy(rom, _baseROM, ROM_SIZE*2);
+        if(!Codec::decodeDeltas(snapshot._ramPages, snapshot._numRamPages, _baseRAM, ram, SNAPSHOT_PAGE_SIZE, SNAPSHOT_RAM_PAGES)  ||
+           !Codec::decodeDeltas(snapshot._romPages, snapshot._numRomPages, _baseROM, rom, SNAPSHOT_ROM_PAGE_SIZE, SNAPSHOT_ROM_PAGES))
+        {
+            fprintf(stderr, "Snapshot::restore() : corrupt RAM or ROM pages\n");
+            return false;
+        }
+
+        // Only touch the ROM when it actually differs, writing through the pointer discards every translation
+        if(memcmp(rom, Cpu::getPtrToROM(), ROM_SIZE*2))
+        {
+            int romSize;
+            memcpy(Cpu::getPtrToROM(romSize), rom, ROM_SIZE*2);
+        }
+
+        Cpu::Machine& machine = Cpu::getMachine();
+        memcpy(machine._RAM, ram, RAM_SIZE);
+        memset(machine._dirtyPages, DIRTY_PAGE_ALL, sizeof machine._dirtyPages);
+        machine._clock = snapshot._clock;
+        machine._IN = snapshot._IN;
+        machine._XOUT = snapshot._XOUT;
+        Audio::setMusicState(snapshot._musicState);
+        Loader::setUploadState(snapshot._uploadState);
+        S = snapshot._state;
+
+        return true;
+    }
+
+
+    struct Reader
+    {
+        const std::vector<uint8_t>& _buffer;
+        size_t _index;
+        bool _valid;
+
+        uint8_t get8(void) {if(_index + 1 > _buffer.size()) {_valid = false; return 0;} return _buffer[_index++];}
+        uint16_t get16(void) {uint16_t lo = get8(); return lo | (uint16_t(get8()) << 8);}
+        uint32_t get32(void) {uint32_t lo = get16(); return lo | (uint32_t(get16()) << 16);}
+        uint64_t get64(void) {uint64_t lo = get32(); return lo | (uint64_t(get32()) << 32);}
+        void getBytes(std::vector<uint8_t>& bytes, size_t length)
+        {
+            if(_index + length > _buffer.size()) {_valid = false; return;}
+            bytes.assign(_buffer.begin() + _index, _buffer.begin() + _index + length);
+            _index += length;
+        }
+    };
+
+    bool saveFile(const std::string& filename, const State& snapshot)
+    {
+        std::vector<uint8_t> buffer;
+        for(int i=0; i<4; i++) Codec::put8(buffer, SNAPSHOT_MAGIC[i]);
+        Codec::put16(buffer, SNAPSHOT_VERSION);
+        Codec::put64(buffer, snapshot._baseRamHash);
+        Codec::put64(buffer, snapshot._baseRomHash);
+
+        const Cpu::State& S = snapshot._state;
+        Codec::put16(buffer, S._PC);
+        Codec::put8(buffer, S._IR); Codec::put8(buffer, S._D); Codec::put8(buffer, S._AC); Codec::put8(buffer, S._X); Codec::put8(buffer, S._Y); Codec::put8(buffer, S._OUT); Codec::put8(buffer, S._undef);
+        Codec::put64(buffer, uint64_t(snapshot._clock));
+        Codec::put8(buffer, snapshot._IN);
+        Codec::put8(buffer, snapshot._XOUT);
+
+        const Audio::MusicState& music = snapshot._musicState;
+        Codec::put32(buffer, uint32_t(music._scoreIndex));
+        Codec::put32(buffer, music._scoreAddress);
+        Codec::put16(buffer, uint16_t(music._midiDelay));
+        Codec::put8(buffer, music._started);
+
+        const Loader::UploadState& upload = snapshot._uploadState;
+        Codec::put8(buffer, upload._frameUploading);
+        Codec::put8(buffer, upload._checksum);
+        Codec::put8(buffer, uint8_t(upload._frameState));
+        Codec::put8(buffer, uint8_t(upload._loaderState));
+        Codec::put32(buffer, uint32_t(upload._msgIdx));
+        for(int i=0; i<PAYLOAD_SIZE; i++) Codec::put8(buffer, upload._payload[i]);
+        Codec::put32(buffer, uint32_t(upload._packetIdx));
+        Codec::put32(buffer, uint32_t(upload._frameCount));
+        Codec::put64(buffer, uint64_t(upload._startClock));
+
+        Codec::put16(buffer, uint16_t(snapshot._numRamPages));
+        Codec::put32(buffer, uint32_t(snapshot._ramPages.size()));
+        buffer.insert(buffer.end(), snapshot._ramPages.begin(), snapshot._ramPages.end());
+        Codec::put16(buffer, uint16_t(snapshot._numRomPages));
+        Codec::put32(buffer, uint32_t(snapshot._romPages.size()));
+        buffer.insert(buffer.end(), snapshot._romPages.begin(), snapshot._romPages.end());
+
+        std::ofstream outfile(filename, std::ios::binary | std::ios::out);
+        if(!outfile.is_open())
+        {
+            fprintf(stderr, "Snapshot::saveFile() : failed to open '%s'\n", filename.c_str());
+            return false;
+        }
+
+        outfile.write((const char*)&buffer[0], buffer.size());
+        if(outfile.bad()  ||  outfile.fail())
+        {
+            fprintf(stderr, "Snapshot::saveFile() : write error in '%s'\n", filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    bool loadFile(const std::string& filename, State& snapshot)
+    {
+        std::ifstream infile(filename, std::ios::binary | std::ios::in);
+        if(!infile.is_open())
+        {
+            fprintf(stderr, "Snapshot::loadFile() : failed to open '%s'\n", filename.c_str());
+            return false;
+        }
+
+        std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+        Reader reader = {buffer, 0, true};
+
+        char magic[4];
+        for(int i=0; i<4; i++) magic[i] = char(reader.get8());
+        uint16_t version = reader.get16();
+        if(!reader._valid  ||  memcmp(magic, SNAPSHOT_MAGIC, 4)  ||  version != SNAPSHOT_VERSION)
+        {
+            fprintf(stderr, "Snapshot::loadFile() : '%s' is not a version %d snapshot\n", filename.c_str(), SNAPSHOT_VERSION);
+            return false;
+        }
+
+        snapshot._baseRamHash = reader.get64();
+        snapshot._baseRomHash = reader.get64();
+
+        Cpu::State& S = snapshot._state;
+        S._PC = reader.get16();
+        S._IR = reader.get8(); S._D = reader.get8(); S._AC = reader.get8(); S._X = reader.get8(); S._Y = reader.get8(); S._OUT = reader.get8(); S._undef = reader.get8();
+        snapshot._clock = int64_t(reader.get64());
+        snapshot._IN = reader.get8();
+        snapshot._XOUT = reader.get8();
+
+        Audio::MusicState& music = snapshot._musicState;
+        music._scoreIndex = int(reader.get32());
+        music._scoreAddress = uint16_t(reader.get32());
+        music._midiDelay = int16_t(reader.get16());
+        music._started = reader.get8() != 0;
+
+        Loader::UploadState& upload = snapshot._uploadState;
+        upload._frameUploading = reader.get8() != 0;
+        upload._checksum = reader.get8();
+        upload._frameState = Loader::FrameState(reader.get8() % Loader::NumFrameStates);
+        upload._loaderState = Loader::LoaderState(reader.get8() % Loader::NumLoaderStates);
+        upload._msgIdx = int(reader.get32()) % PAYLOAD_SIZE;
+        for(int i=0; i<PAYLOAD_SIZE; i++) upload._payload[i] = reader.get8();
+        upload._packetIdx = int(reader.get32());
+        upload._frameCount = int(reader.get32());
+        upload._startClock = int64_t(reader.get64());
+
+        snapshot._numRamPages = reader.get16();
+        reader.getBytes(snapshot._ramPages, reader.get32());
+        snapshot._numRomPages = reader.get16();
+        reader.getBytes(snapshot._romPages, reader.get32());
+
+        if(!reader._valid  ||  reader._index != buffer.size())
+        {
+            fprintf(stderr, "Snapshot::loadFile() : '%s' is truncated or corrupt\n", filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+
+    bool update(Cpu::State& S)
+    {
+        static State snapshot;
+
+        Request request = _request;
+        _request = None;
+
+        switch(request)
+        {
+            case Save:
+            {
+                capture(snapshot, S);
+                if(saveFile(SNAPSHOT_FILE, snapshot))
+                {
+                    fprintf(stderr, "Snapshot::update() : saved '%s' : %d RAM pages : %d ROM pages\n", SNAPSHOT_FILE, snapshot._numRamPages, snapshot._numRomPages);
+                }
+            }
+            break;
+
+            case Load:
+            {
+                if(loadFile(SNAPSHOT_FILE, snapshot)  &&  restore(snapshot, S))
+                {
+                    fprintf(stderr, "Snapshot::update() : loaded '%s'\n", SNAPSHOT_FILE);
+                    return true;
+                }
+            }
+            break;
+
+            default: break;
+        }
+
+        return false;
+    }
+}
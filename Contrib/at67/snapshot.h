@@ -0,0 +1,68 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "audio.h"
+#include "loader.h"
+
+
+#define SNAPSHOT_FILE     "snapshot.gts"
+#define SNAPSHOT_MAGIC    "GTSS"
+#define SNAPSHOT_VERSION  2
+
+#define SNAPSHOT_PAGE_SIZE      256
+#define SNAPSHOT_RAM_PAGES      (RAM_SIZE/SNAPSHOT_PAGE_SIZE)
+#define SNAPSHOT_ROM_PAGES      (ROM_SIZE/SNAPSHOT_PAGE_SIZE)
+#define SNAPSHOT_ROM_PAGE_SIZE  (SNAPSHOT_PAGE_SIZE*2)
+
+
+namespace Snapshot
+{
+    enum Request {None=0, Save, Load};
+
+    // Everything that decides what the emulator does next, RAM and ROM are only stored for the pages that differ from the base images,
+    // each as its page number, a 16 bit length and the page XOR'ed with the base and run length encoded; two snapshots of the same
+    // machine with the same base images are byte for byte identical
+    struct State
+    {
+        Cpu::State _state;
+        int64_t _clock = 0;
+        uint8_t _IN = 0xFF, _XOUT = 0x00;
+        Audio::MusicState _musicState;
+        Loader::UploadState _uploadState;
+
+        uint64_t _baseRamHash = 0;
+        uint64_t _baseRomHash = 0;
+        int _numRamPages = 0;
+        int _numRomPages = 0;
+        std::vector<uint8_t> _ramPages;
+        std::vector<uint8_t> _romPages;
+    };
+
+
+    Request getRequest(void);
+    uint64_t getBaseRamHash(void);
+    uint64_t getBaseRomHash(void);
+
+    void setRequest(Request request);
+    void setBaseRAM(const uint8_t* ram);
+
+    // The ROM as it is now becomes the base ROM image, the base RAM image starts out as all zeros
+    void initialise(void);
+
+    void capture(State& snapshot, const Cpu::State& S);
+    bool restore(const State& snapshot, Cpu::State& S);
+
+    bool saveFile(const std::string& filename, const State& snapshot);
+    bool loadFile(const std::string& filename, State& snapshot);
+
+    // Services a save or load request from the Editor, main() calls this on the falling edge of vSync with the current state,
+    // returns true when the machine was restored and the clock has jumped
+    bool update(Cpu::State& S);
+}
+
+#endif
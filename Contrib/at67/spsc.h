@@ -0,0 +1,70 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+#include <atomic>
+
+
+namespace Spsc
+{
+    // Single producer single consumer ring, SIZE must be a power of 2; only the producer writes _tail and only the consumer writes _head,
+    // so neither side ever waits on the other, a push to a full queue and a pop from an empty one simply fail
+    template <typename T, int SIZE> struct Queue
+    {
+        T _items[SIZE];
+        std::atomic<uint32_t> _head{0};
+        std::atomic<uint32_t> _tail{0};
+    };
+
+
+    template <typename T, int SIZE> bool push(Queue<T, SIZE>& queue, const T& item)
+    {
+        uint32_t tail = queue._tail.load(std::memory_order_relaxed);
+        if(tail - queue._head.load(std::memory_order_acquire) == SIZE) return false;
+
+        queue._items[tail & (SIZE-1)] = item;
+        queue._tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T, int SIZE> bool pop(Queue<T, SIZE>& queue, T& item)
+    {
+        uint32_t head = queue._head.load(std::memory_order_relaxed);
+        if(queue._tail.load(std::memory_order_acquire) == head) return false;
+
+        item = queue._items[head & (SIZE-1)];
+        queue._head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Block versions, as many items as there is room for or as there are, with one acquire and one release for the lot
+    template <typename T, int SIZE> uint32_t push(Queue<T, SIZE>& queue, const T* items, uint32_t count)
+    {
+        uint32_t tail = queue._tail.load(std::memory_order_relaxed);
+        uint32_t room = SIZE - (tail - queue._head.load(std::memory_order_acquire));
+        if(count > room) count = room;
+
+        for(uint32_t i=0; i<count; i++) queue._items[(tail + i) & (SIZE-1)] = items[i];
+        queue._tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    template <typename T, int SIZE> uint32_t pop(Queue<T, SIZE>& queue, T* items, uint32_t count)
+    {
+        uint32_t head = queue._head.load(std::memory_order_relaxed);
+        uint32_t available = queue._tail.load(std::memory_order_acquire) - head;
+        if(count > available) count = available;
+
+        for(uint32_t i=0; i<count; i++) items[i] = queue._items[(head + i) & (SIZE-1)];
+        queue._head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Only exact from the producer or consumer side, anyone else gets an estimate
+    template <typename T, int SIZE> uint32_t size(const Queue<T, SIZE>& queue)
+    {
+        return queue._tail.load(std::memory_order_acquire) - queue._head.load(std::memory_order_acquire);
+    }
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include <algorithm>
 
 #include <SDL.h>
+#include "audio.h"
 #include "timing.h"
 
 
@@ -9,32 +10,103 @@ namespace Timing
     bool _frameUpdate = false;
     uint64_t _frameCount = 0;
     double _frameTime = 0.0;
-    double _timingAdjust = VSYNC_TIMING_60;
+    double _timingAdjust = VSYNC_TIMING_GIGA;
+
+#ifdef TIMING_SLAVE_TO_AUDIO
+    bool _slaveToAudio = true;
+#else
+    bool _slaveToAudio = false;
+#endif
+
+    // Deadlines are absolute so that sleeping late on one frame is made up on the next rather than accumulating
+    uint64_t _deadline = 0;
+    uint64_t _pacingStart = 0;
+    uint64_t _pacingFrames = 0;
+    PacingStats _pacingStats;
 
 
     bool getFrameUpdate(void) {return _frameUpdate;}
     uint64_t getFrameCount(void) {return _frameCount;}
     double getFrameTime(void) {return _frameTime;}
     double getTimingHack(void) {return _timingAdjust;}
+    bool getSlaveToAudio(void) {return _slaveToAudio;}
+    const PacingStats& getPacingStats(void) {return _pacingStats;}
 
     void setFrameUpdate(bool update) {_frameUpdate = update;}
     void setTimingHack(double hack) {_timingAdjust = hack;}
+    void setSlaveToAudio(bool slave) {_slaveToAudio = slave; Audio::setRateControl(!slave);}
+    void resetPacingStats(void) {_pacingStats = PacingStats(); _deadline = 0;}
+
+
+    // More audio queued than the target means emulation is ahead of the device, so frames get slightly longer and vice versa
+    double audioCorrection(void)
+    {
+        if(!_slaveToAudio) return 0.0;
+
+        double error = double(int(Audio::getQueuedSamples()) - TIMING_AUDIO_TARGET) / double(TIMING_AUDIO_TARGET);
+        return std::min(std::max(error * TIMING_AUDIO_CORRECTION, -TIMING_AUDIO_CORRECTION), TIMING_AUDIO_CORRECTION);
+    }
+
+    void waitUntil(uint64_t deadline, uint64_t frequency)
+    {
+        uint64_t margin = uint64_t(TIMING_SPIN_MARGIN * double(frequency));
+        for(;;)
+        {
+            uint64_t now = SDL_GetPerformanceCounter();
+            if(now >= deadline) return;
 
+            uint64_t remaining = deadline - now;
+            if(remaining <= margin) continue;
+
+            uint32_t ms = uint32_t((remaining - margin) * 1000 / frequency);
+            if(ms) SDL_Delay(ms);
+        }
+    }
 
     void synchronise(void)
     {
         static uint64_t prevFrameCounter = 0;
 
-        do
+        uint64_t frequency = SDL_GetPerformanceFrequency();
+        uint64_t now = SDL_GetPerformanceCounter();
+
+        // An unthrottled speed hack or the first frame after a pause just restarts the deadlines
+        _pacingStats._audioCorrection = audioCorrection();
+        uint64_t period = uint64_t(_timingAdjust * (1.0 + _pacingStats._audioCorrection) * double(frequency));
+        bool paused = _deadline  &&  now > _deadline + uint64_t(TIMING_RESYNC * double(frequency));
+        if(_deadline == 0  ||  period == 0  ||  paused)
+        {
+            if(paused) _pacingStats._resyncs++;
+            _deadline = now;
+            _pacingStart = now;
+            _pacingFrames = 0;
+        }
+        else
         {
-            _frameTime = double(SDL_GetPerformanceCounter() - prevFrameCounter) / double(SDL_GetPerformanceFrequency());
+            // Missed by more than a whole frame, the frame is dropped from the schedule rather than rushed through
+            _deadline += period;
+            if(now > _deadline + period)
+            {
+                _pacingStats._missed++;
+                _deadline = now;
+            }
+
+            waitUntil(_deadline, frequency);
+
+            double late = double(SDL_GetPerformanceCounter() - _deadline) / double(frequency);
+            _pacingStats._jitter[std::min(int(late / TIMING_JITTER_BUCKET), TIMING_JITTER_BUCKETS-1)]++;
         }
-        while(_frameTime < _timingAdjust);
-        prevFrameCounter = SDL_GetPerformanceCounter();
+
+        now = SDL_GetPerformanceCounter();
+        _pacingStats._frames++;
+        _pacingStats._drift = double(now - _pacingStart) / double(frequency) - double(_pacingFrames++) * VSYNC_TIMING_GIGA;
+
+        _frameTime = double(now - prevFrameCounter) / double(frequency);
+        prevFrameCounter = now;
 
         _frameCount++;
 
         // Used for updating at a constant 60 times per second no matter what the FPS is
         _frameUpdate = ((_frameCount % int(1.0*VSYNC_TIMING_60/std::min(_frameTime, VSYNC_TIMING_60))) == 0);
     }
-}
\ No newline at end of file
+}
@@ -13,6 +13,9 @@
 #define HPIXELS_END      173
 #define VSYNC_TIMING_60  0.0166667
 
+// A real Gigatron frame, 521 lines of 200 cycles at 6.25MHz, (59.98Hz)
+#define VSYNC_TIMING_GIGA  (double(SCAN_LINES*HLINE_END) / double(CLOCK_FREQ))
+
 #define CLOCK_FREQ   6250000
 #define CLOCK_RESET -3
 
@@ -20,16 +23,45 @@
 #define CPU_STALL_CLOCKS        500000
 #define SINGLE_STEP_STALL_TIME  1000
 
+// Frame pacing sleeps until this close to the deadline and spins the rest, a late frame by more than TIMING_RESYNC is taken as
+// a pause, (debugger, window drag), and the deadlines start again from now rather than being counted as missed
+#define TIMING_SPIN_MARGIN     0.001
+#define TIMING_RESYNC          0.25
+#define TIMING_JITTER_BUCKETS  16
+#define TIMING_JITTER_BUCKET   0.0001
+
+// Slaving to audio stretches or shrinks the frame period by up to this fraction to hold the queued audio at its target
+#define TIMING_AUDIO_CORRECTION  0.005
+#define TIMING_AUDIO_TARGET      (SCAN_LINES*2)
+//#define TIMING_SLAVE_TO_AUDIO
+
 
 namespace Timing
 {
+    // Jitter is how late synchronise() returned past each deadline, in buckets of TIMING_JITTER_BUCKET seconds with the last bucket
+    // catching everything later; drift is how far wall time has run ahead of the same number of real Gigatron frames
+    struct PacingStats
+    {
+        uint64_t _frames = 0;
+        uint64_t _missed = 0;
+        uint64_t _resyncs = 0;
+        double _drift = 0.0;
+        double _audioCorrection = 0.0;
+        uint32_t _jitter[TIMING_JITTER_BUCKETS] = {0};
+    };
+
+
     bool getFrameUpdate(void);
     uint64_t getFrameCount(void);
     double getFrameTime(void);
     double getTimingHack(void);
+    bool getSlaveToAudio(void);
+    const PacingStats& getPacingStats(void);
 
     void setFrameUpdate(bool update);
     void setTimingHack(double hack);
+    void setSlaveToAudio(bool slave);
+    void resetPacingStats(void);
 
     void synchronise(void);
 }
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+#include "../../capture.h"
+
+
+#define GTCAPTURE_MAJOR_VERSION "0.1"
+#define GTCAPTURE_MINOR_VERSION "0"
+#define GTCAPTURE_VERSION_STR "gtcapture v" GTCAPTURE_MAJOR_VERSION "." GTCAPTURE_MINOR_VERSION
+
+#define SCALE_MAX      8
+#define COLOUR_PALETTE 64
+
+// Largest stored, (uncompressed), deflate block
+#define DEFLATE_BLOCK  65535
+
+
+uint32_t _crcTable[256];
+
+
+void initialiseCrc(void)
+{
+    for(uint32_t n=0; n<256; n++)
+    {
+        uint32_t c = n;
+        for(int k=0; k<8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        _crcTable[n] = c;
+    }
+}
+
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc=0xFFFFFFFF)
+{
+    for(size_t i=0; i<length; i++) crc = _crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+uint32_t adler32(const uint8_t* data, size_t length)
+{
+    uint32_t a = 1, b = 0;
+    for(size_t i=0; i<length; i++)
+    {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+// PNG is big endian
+void put32(std::vector<uint8_t>& buffer, uint32_t value)
+{
+    for(int i=3; i>=0; i--) buffer.push_back(uint8_t(value >> (i*8)));
+}
+
+void putChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data)
+{
+    put32(png, uint32_t(data.size()));
+    size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    put32(png, crc32(&png[start], png.size() - start) ^ 0xFFFFFFFF);
+}
+
+// 8 bit indexed colour with the Gigatron's 64 colour palette, lossless and readable by anything, the image data is stored rather
+// than compressed as the captures themselves are the compact form
+bool writePng(const std::string& filename, const Capture::Frame& frame, int scale)
+{
+    int width = CAPTURE_WIDTH * scale;
+    int height = CAPTURE_HEIGHT * scale;
+
+    std::vector<uint8_t> raw;
+    raw.reserve((width + 1) * height);
+    for(int y=0; y<height; y++)
+    {
+        raw.push_back(0);
+        const uint8_t* line = &frame._pixels[(y/scale) * CAPTURE_WIDTH];
+        for(int x=0; x<width; x++) raw.push_back(line[x/scale]);
+    }
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+    std::vector<uint8_t> ihdr;
+    put32(ihdr, width);
+    put32(ihdr, height);
+    ihdr.push_back(8);
+    ihdr.push_back(3);
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    putChunk(png, "IHDR", ihdr);
+
+    std::vector<uint8_t> plte;
+    for(int i=0; i<COLOUR_PALETTE; i++)
+    {
+        plte.push_back(uint8_t(((i>>0) & 3) * 0x55));
+        plte.push_back(uint8_t(((i>>2) & 3) * 0x55));
+        plte.push_back(uint8_t(((i>>4) & 3) * 0x55));
+    }
+    putChunk(png, "PLTE", plte);
+
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    for(size_t i=0; i<raw.size(); i+=DEFLATE_BLOCK)
+    {
+        size_t length = std::min(raw.size() - i, size_t(DEFLATE_BLOCK));
+        idat.push_back((i + length == raw.size()) ? 1 : 0);
+        idat.push_back(uint8_t(length));
+        idat.push_back(uint8_t(length >> 8));
+        idat.push_back(uint8_t(~length));
+        idat.push_back(uint8_t(~length >> 8));
+        idat.insert(idat.end(), raw.begin() + i, raw.begin() + i + length);
+    }
+    put32(idat, adler32(&raw[0], raw.size()));
+    putChunk(png, "IDAT", idat);
+
+    putChunk(png, "IEND", std::vector<uint8_t>());
+
+    std::ofstream outfile(filename, std::ios::binary | std::ios::out);
+    if(!outfile.is_open())
+    {
+        fprintf(stderr, "gtcapture : couldn't open %s for writing.\n", filename.c_str());
+        return false;
+    }
+    outfile.write((const char*)&png[0], png.size());
+    if(outfile.bad()  ||  outfile.fail())
+    {
+        fprintf(stderr, "gtcapture : failed to write %s.\n", filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    int scale = 1;
+    uint32_t first = 0, count = 0xFFFFFFFF;
+    std::vector<std::string> filenames;
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "-scale"  &&  i + 1 < argc)      scale = strtol(argv[++i], nullptr, 0);
+        else if(arg == "-first"  &&  i + 1 < argc) first = strtoul(argv[++i], nullptr, 0);
+        else if(arg == "-count"  &&  i + 1 < argc) count = strtoul(argv[++i], nullptr, 0);
+        else filenames.push_back(arg);
+    }
+
+    if(filenames.size() != 2  ||  scale < 1  ||  scale > SCALE_MAX)
+    {
+        fprintf(stderr, "%s\n", GTCAPTURE_VERSION_STR);
+        fprintf(stderr, "Usage:   gtcapture [-scale <1-%d>] [-first <frame>] [-count <frames>] <input filename> <output prefix>\n", SCALE_MAX);
+        return 1;
+    }
+
+    std::ifstream infile;
+    if(!Capture::openFile(filenames[0], infile)) return 1;
+
+    initialiseCrc();
+
+    // Every frame has to be decoded to reach the next, only the requested ones are written
+    Capture::Frame frame;
+    uint32_t frames = 0, written = 0, dropped = 0, expected = 0;
+    while(Capture::readFrame(infile, frame))
+    {
+        dropped += frame._number - expected;
+        expected = frame._number + 1;
+        frames++;
+
+        if(frame._number < first  ||  frame._number - first >= count) continue;
+
+        char filename[32];
+        sprintf(filename, "_%06u.png", frame._number);
+        if(!writePng(filenames[1] + filename, frame, scale)) return 1;
+        written++;
+    }
+
+    fprintf(stderr, "gtcapture : %u frames decoded : %u dropped during capture : %u written\n", frames, dropped, written);
+
+    return 0;
+}
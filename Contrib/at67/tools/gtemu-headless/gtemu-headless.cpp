@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "../../memory.h"
+#include "../../cpu.h"
+#include "../../vcpu.h"
+#include "../../analyser.h"
+#include "../../audio.h"
+#include "../../wav.h"
+#include "../../loader.h"
+#include "../../pool.h"
+#include "../../snapshot.h"
+#include "../../lockstep.h"
+#include "../../timing.h"
+#include "../../assembler.h"
+#include "../../expression.h"
+#include "../../compiler.h"
+
+
+#define GTEMU_HEADLESS_MAJOR_VERSION "0.1"
+#define GTEMU_HEADLESS_MINOR_VERSION "0"
+#define GTEMU_HEADLESS_VERSION_STR "gtemu-headless v" GTEMU_HEADLESS_MAJOR_VERSION "." GTEMU_HEADLESS_MINOR_VERSION
+
+// Enough for the ROM to get through its startup delay and reach the main menu
+#define BOOT_FRAMES_DEFAULT  150
+#define RUN_FRAMES_DEFAULT   600
+#define RANDOM_SEED_DEFAULT  1
+
+// Same layout as graphics.h, which can't be included without SDL
+#define FRAME_WIDTH   160
+#define FRAME_HEIGHT  480
+#define GIGA_HEIGHT   120
+#define GIGA_VRAM     0x0800
+#define GIGA_VTABLE   0x0100
+
+
+// OUT colour bits of every visible pixel, the frame being drawn and the last completed one
+uint8_t _frameBuffer[FRAME_HEIGHT][FRAME_WIDTH];
+uint8_t _frameCompleted[FRAME_HEIGHT][FRAME_WIDTH];
+
+// Beam position, a snapshot is always taken on a falling vSync edge
+int _vgaX = 0, _vgaY = 0;
+
+// XOUT's 4 audio bits at every rising hSync edge, (one sample per scanline), while recording
+bool _recording = false;
+std::vector<uint8_t> _samples;
+
+
+uint64_t hash(const uint8_t* data, size_t length)
+{
+    uint64_t result = 0xCBF29CE484222325ULL;
+    for(size_t i=0; i<length; i++) result = (result ^ data[i]) * 0x00000100000001B3ULL;
+    return result;
+}
+
+// Same loop as main(), minus the display, audio output, input and watchdog, stops on a falling vSync edge when counting frames
+int64_t emulate(Cpu::State& S, int frames, int64_t maxCycles, int& framesDone)
+{
+    Cpu::EventSink sink;
+    sink._events = Cpu::EventOut | Cpu::EventHSync | Cpu::EventVSync | (Cpu::getBurstMode() ? Cpu::EventBurst : 0);
+
+    int64_t cyclesDone = 0;
+    framesDone = 0;
+    while(framesDone < frames  &&  cyclesDone < maxCycles)
+    {
+        int64_t clock = Cpu::getClock();
+
+        // MCP100 Power-On Reset
+        if(clock < 0) S._PC = 0;
+
+        bool analysing = Analyser::getAnalysing();
+        Cpu::State T = S;
+        int64_t cycles = Cpu::run(T, (clock < 0  ||  analysing) ? 1 : HLINE_END, sink);
+        if(analysing) Analyser::cycle(S, T, clock);
+        cyclesDone += cycles;
+
+        int HSync = (T._OUT & 0x40) - (S._OUT & 0x40);
+        int VSync = (T._OUT & 0x80) - (S._OUT & 0x80);
+
+        // Falling vSync edge
+        if(VSync < 0)
+        {
+            _vgaY = VSYNC_START;
+            Audio::playMusic();
+            memcpy(_frameCompleted, _frameBuffer, sizeof _frameBuffer);
+            framesDone++;
+        }
+
+        // Pixels, a pixel burst took the last cycles of the run and brings its own OUT for each of them
+        int64_t burst = (sink._event & Cpu::EventBurst) ? cycles - sink._burstLength : cycles;
+        for(int64_t i=0; i<cycles; i++)
+        {
+            if(_vgaX++ < HLINE_END)
+            {
+                if(_vgaY >= 0  &&  _vgaY < FRAME_HEIGHT  &&  _vgaX >= HPIXELS_START  &&  _vgaX < HPIXELS_END)
+                {
+                    _frameBuffer[_vgaY][_vgaX-HPIXELS_START] = ((i < burst) ? S._OUT : sink._burst[i - burst]) & 0x3F;
+                }
+            }
+        }
+
+        // Rising hSync edge
+        if(HSync > 0)
+        {
+            Cpu::setXOUT(T._AC);
+            if(_recording) _samples.push_back(Cpu::getXOUT() >>4);
+            Loader::upload(_vgaY);
+            _vgaX = 0;
+            _vgaY++;
+
+            // Change this once in a while, seeded so that runs are repeatable
+            T._undef = rand() & 0xff;
+        }
+
+        S = T;
+    }
+
+    return cyclesDone;
+}
+
+// Same as Loader::uploadDirect() for the emulator, returns the address to execute; a .gt1 can instead go through the emulated Loader
+// protocol, in which case there is nothing to execute until it has been sent
+bool loadFile(const std::string& filename, bool useLoader, uint16_t& executeAddress)
+{
+    std::string filepath = filename;
+    size_t suffix = filepath.find_last_of(".");
+    if(suffix == std::string::npos)
+    {
+        fprintf(stderr, "gtemu-headless : invalid filename '%s'\n", filepath.c_str());
+        return false;
+    }
+
+    size_t lastDirSep = filepath.find_last_of("/\\");
+    if(lastDirSep != std::string::npos) Assembler::setIncludePath(filepath.substr(0, lastDirSep+1));
+
+    // Compile gbas to gasm
+    if(filepath.find(".gbas") != filepath.npos)
+    {
+        std::string output = filepath.substr(0, suffix) + ".gasm";
+        if(!Compiler::compile(filepath, output)) return false;
+        filepath = output;
+    }
+
+    if(filepath.find(".gt1") != filepath.npos)
+    {
+        Loader::Gt1File gt1File;
+        if(!Loader::loadGt1File(filepath, gt1File)) return false;
+        executeAddress = gt1File._loStart + (gt1File._hiStart <<8);
+        if(useLoader) return Loader::startUpload(gt1File);
+
+        for(int j=0; j<int(gt1File._segments.size()); j++)
+        {
+            uint16_t address = gt1File._segments[j]._loAddress + (gt1File._segments[j]._hiAddress <<8);
+            for(int i=0; i<int(gt1File._segments[j]._dataBytes.size()); i++)
+            {
+                Cpu::setRAM(address+i, gt1File._segments[j]._dataBytes[i]);
+            }
+        }
+    }
+    else if(filepath.find(".gasm") != filepath.npos  ||  filepath.find(".vasm") != filepath.npos  ||  filepath.find(".s") != filepath.npos  ||  filepath.find(".asm") != filepath.npos)
+    {
+        if(!Assembler::assemble(filepath, DEFAULT_START_ADDRESS)) return false;
+        executeAddress = Assembler::getStartAddress();
+
+        uint16_t address = executeAddress;
+        uint16_t customAddress = executeAddress;
+        Assembler::ByteCode byteCode;
+        while(!Assembler::getNextAssembledByte(byteCode))
+        {
+            if(byteCode._isCustomAddress)
+            {
+                address = byteCode._address;
+                customAddress = address;
+            }
+
+            (byteCode._isRomAddress) ? Cpu::setROM(customAddress, address++, byteCode._data) : Cpu::setRAM(address++, byteCode._data);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "gtemu-headless : wrong file extension in '%s' : must be one of : '.gt1' or '.gasm' or '.vasm' or '.gbas'\n", filename.c_str());
+        return false;
+    }
+
+    // Reset video table
+    for(int i=0; i<GIGA_HEIGHT; i++)
+    {
+        Cpu::setRAM(GIGA_VTABLE + i*2, (GIGA_VRAM >>8) + i);
+        Cpu::setRAM(GIGA_VTABLE + 1 + i*2, 0x00);
+    }
+
+    return true;
+}
+
+// vCPU starts at the address the ROM's main menu would have put there
+void setExecuteAddress(uint16_t executeAddress)
+{
+    Cpu::setRAM(0x0016, (executeAddress-2) & 0x00FF);
+    Cpu::setRAM(0x0017, (executeAddress & 0xFF00) >>8);
+    Cpu::setRAM(0x001a, (executeAddress-2) & 0x00FF);
+    Cpu::setRAM(0x001b, (executeAddress & 0xFF00) >>8);
+}
+
+// One of the 8 buttons, or none, held for a frame, (LOCKSTEP_CHUNK_CYCLES), chosen from nothing but the seed, the machine and the
+// frame so that the Pool and Lockstep, and every number of threads, see the same input
+uint8_t randomButtons(unsigned int seed, int machine, int64_t cycles)
+{
+    uint64_t key[3] = {seed, uint64_t(machine), uint64_t(cycles / LOCKSTEP_CHUNK_CYCLES)};
+    int button = int(hash((const uint8_t*)key, sizeof key) % 9);
+    return (button < 8) ? uint8_t(~(1 << button)) : 0xFF;
+}
+
+// Every file gets a machine of its own, a copy of the booted main machine, loaded through the Cpu accessors with that machine current,
+// and the Pool, or Lockstep when a kernel is given, runs them all for the same number of cycles; only RAM and the registers are
+// hashed, runMachine() has no display
+int runBatch(const std::vector<std::string>& filenames, int jobs, int lockstepKernel, unsigned int inputSeed, int64_t cycles)
+{
+    std::vector<Cpu::Machine> machines(filenames.size(), Cpu::getMainMachine());
+    std::vector<Cpu::Machine*> batch;
+    for(int i=0; i<int(filenames.size()); i++)
+    {
+        Cpu::setMachine(machines[i]);
+        uint16_t executeAddress;
+        bool loaded = loadFile(filenames[i], false, executeAddress);
+        if(loaded) setExecuteAddress(executeAddress);
+        Cpu::setMachine(Cpu::getMainMachine());
+        if(!loaded) return 1;
+
+        batch.push_back(&machines[i]);
+    }
+
+    Pool::initialise(jobs);
+    int threads = Pool::getNumThreads();
+
+    if(lockstepKernel >= 0)
+    {
+        Lockstep::initialise();
+        Lockstep::setKernel(lockstepKernel);
+    }
+
+    Lockstep::Input input;
+    if(inputSeed) input = [inputSeed](int machine, int64_t cyclesDone) {return randomButtons(inputSeed, machine, cyclesDone);};
+
+    int fallbacks = 0;
+    auto start = std::chrono::steady_clock::now();
+    if(lockstepKernel >= 0)
+    {
+        fallbacks = Lockstep::run(batch, cycles, input);
+    }
+    else if(input)
+    {
+        // The same chunks Lockstep::run() gives input in
+        for(int64_t cyclesDone=0; cyclesDone<cycles; cyclesDone+=LOCKSTEP_CHUNK_CYCLES)
+        {
+            for(int i=0; i<int(batch.size()); i++) batch[i]->_IN = input(i, cyclesDone);
+            Pool::run(batch, std::min(int64_t(LOCKSTEP_CHUNK_CYCLES), cycles - cyclesDone));
+        }
+    }
+    else
+    {
+        Pool::run(batch, cycles);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Pool::shutdown();
+
+    double mcps = (seconds > 0.0) ? double(cycles) * double(batch.size()) / seconds / 1.0e6 : 0.0;
+    printf("%s : %d machines : %d threads : cycles %" PRId64 " each : %.3f seconds : %.2f Mcycles/s\n", GTEMU_HEADLESS_VERSION_STR, int(batch.size()), threads, cycles, seconds, mcps);
+    if(lockstepKernel >= 0)
+    {
+        int batches = (int(batch.size()) + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES;
+        printf("lockstep %s : %d batches : %d fell back to the pool\n", Lockstep::getKernelName(), batches, fallbacks);
+    }
+    for(int i=0; i<int(machines.size()); i++)
+    {
+        const Cpu::State& S = machines[i]._state;
+        printf("ram %016" PRIx64 " : PC %04x : AC %02x : X %02x : Y %02x : OUT %02x : %s\n", hash(machines[i]._RAM, RAM_SIZE), S._PC, S._AC, S._X, S._Y, S._OUT, filenames[i].c_str());
+    }
+
+    return 0;
+}
+
+bool loadRom(const std::string& filename)
+{
+    std::ifstream romfile(filename, std::ios::binary | std::ios::in);
+    if(!romfile.is_open())
+    {
+        fprintf(stderr, "gtemu-headless : couldn't open %s ROM file.\n", filename.c_str());
+        return false;
+    }
+
+    int romSize;
+    uint8_t* rom = Cpu::getPtrToROM(romSize);
+    romfile.read((char *)rom, romSize);
+    if(romfile.bad())
+    {
+        fprintf(stderr, "gtemu-headless : failed to read %s ROM file.\n", filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool saveRam(const std::string& filename)
+{
+    std::ofstream ramfile(filename, std::ios::binary | std::ios::out);
+    if(!ramfile.is_open())
+    {
+        fprintf(stderr, "gtemu-headless : couldn't open %s for writing.\n", filename.c_str());
+        return false;
+    }
+
+    ramfile.write((const char *)Cpu::getPtrToRAM(), RAM_SIZE);
+    if(ramfile.bad()  ||  ramfile.fail())
+    {
+        fprintf(stderr, "gtemu-headless : failed to write %s.\n", filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Replaces booting, the snapshot has to have been taken against the same ROM, either here or by the emulator
+bool loadSnapshot(const std::string& filename, Cpu::State& S)
+{
+    Snapshot::State snapshot;
+    if(!Snapshot::loadFile(filename, snapshot)  ||  !Snapshot::restore(snapshot, S)) return false;
+
+    _vgaY = VSYNC_START;
+
+    return true;
+}
+
+// Only runs that end counting frames end on the falling vSync edge a snapshot is expected to start from
+bool saveSnapshot(const std::string& filename, const Cpu::State& S)
+{
+    Snapshot::State snapshot;
+    Snapshot::capture(snapshot, S);
+    if(!Snapshot::saveFile(filename, snapshot)) return false;
+
+    printf("snapshot %s : %d RAM pages : %d ROM pages\n", filename.c_str(), snapshot._numRamPages, snapshot._numRomPages);
+
+    return true;
+}
+
+
+// The hash is of the native samples, which are identical on every build and in every mode, the resampled .wav is floating point
+bool saveWav(const std::string& filename, int rate)
+{
+    std::vector<int16_t> pcm(_samples.size());
+    for(int i=0; i<int(_samples.size()); i++) pcm[i] = int16_t(AUDIO_PCM(_samples[i]));
+
+    if(rate)
+    {
+        std::vector<int16_t> resampled;
+        Wav::resample(pcm, AUDIO_SCANLINE_RATE, rate, resampled);
+        pcm.swap(resampled);
+    }
+    else
+    {
+        rate = int(AUDIO_SCANLINE_RATE);
+    }
+
+    if(!Wav::writeFile(filename, pcm, rate)) return false;
+
+    printf("audio %016" PRIx64 " : %d samples : %.3f seconds : %d Hz\n", hash(_samples.size() ? &_samples[0] : nullptr, _samples.size()), int(_samples.size()), double(_samples.size()) / AUDIO_SCANLINE_RATE, rate);
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::string romFilename, ramFilename, timingFilename, wavFilename, snapshotFilename, saveFilename, filename;
+    std::vector<std::string> filenames;
+    int bootFrames = BOOT_FRAMES_DEFAULT;
+    int runFrames = RUN_FRAMES_DEFAULT;
+    int64_t runCycles = 0;
+    int64_t benchmarkCycles = 0;
+    int vcpuMode = VCPU_MODE_DEFAULT;
+    int burstMode = BURST_MODE_DEFAULT;
+    int wavRate = 0;
+    int jobs = -1;
+    int lockstepKernel = -1;
+    unsigned int inputSeed = 0;
+    bool useLoader = false;
+    std::vector<int> musicScores;
+    unsigned int seed = RANDOM_SEED_DEFAULT;
+
+    for(int i=1; i<argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if(arg == "-rom"  &&  hasValue)         romFilename = argv[++i];
+        else if(arg == "-ram"  &&  hasValue)    ramFilename = argv[++i];
+        else if(arg == "-timing"  &&  hasValue) timingFilename = argv[++i];
+        else if(arg == "-wav"  &&  hasValue)    wavFilename = argv[++i];
+        else if(arg == "-rate"  &&  hasValue)   wavRate = atoi(argv[++i]);
+        else if(arg == "-music"  &&  hasValue)  musicScores.push_back(atoi(argv[++i]));
+        else if(arg == "-boot"  &&  hasValue)   bootFrames = atoi(argv[++i]);
+        else if(arg == "-snapshot"  &&  hasValue) snapshotFilename = argv[++i];
+        else if(arg == "-save"  &&  hasValue)   saveFilename = argv[++i];
+        else if(arg == "-frames"  &&  hasValue) runFrames = atoi(argv[++i]);
+        else if(arg == "-cycles"  &&  hasValue) runCycles = strtoll(argv[++i], NULL, 10);
+        else if(arg == "-vcpu"  &&  hasValue)   vcpuMode = atoi(argv[++i]);
+        else if(arg == "-burst"  &&  hasValue)  burstMode = atoi(argv[++i]);
+        else if(arg == "-loader")               useLoader = true;
+        else if(arg == "-seed"  &&  hasValue)   seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else if(arg == "-benchmark"  &&  hasValue) benchmarkCycles = strtoll(argv[++i], NULL, 10);
+        else if(arg == "-jobs"  &&  hasValue)   jobs = atoi(argv[++i]);
+        else if(arg == "-lockstep"  &&  hasValue) lockstepKernel = atoi(argv[++i]);
+        else if(arg == "-input"  &&  hasValue)  inputSeed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else if(arg[0] != '-')                  filenames.push_back(arg);
+        else
+        {
+            fprintf(stderr, "%s\n", GTEMU_HEADLESS_VERSION_STR);
+            fprintf(stderr, "Usage:   gtemu-headless [options] [<input filename>]\n");
+            fprintf(stderr, "         gtemu-headless -jobs <threads> [options] <input filename> ...\n");
+            fprintf(stderr, "         -rom <filename>   ROM image, (default is test.rom when present, otherwise the built in ROM)\n");
+            fprintf(stderr, "         -boot <frames>    frames to run before loading the input file, (default %d)\n", BOOT_FRAMES_DEFAULT);
+            fprintf(stderr, "         -snapshot <filename> starts from a save state instead of booting, (-save or the emulator's F2)\n");
+            fprintf(stderr, "         -save <filename>  writes a save state when finished, (-frames 0 saves straight after booting)\n");
+            fprintf(stderr, "         -frames <frames>  frames to run after loading, (default %d)\n", RUN_FRAMES_DEFAULT);
+            fprintf(stderr, "         -cycles <cycles>  cycles to run after loading, overrides -frames\n");
+            fprintf(stderr, "         -vcpu <mode>      0 off, 1 on, 2 self check, (default %d)\n", VCPU_MODE_DEFAULT);
+            fprintf(stderr, "         -burst <mode>     0 off, 1 pixel bursts executed as one step\n");
+            fprintf(stderr, "         -seed <seed>      seed for the power on RAM and the undefined bus, (default %d)\n", RANDOM_SEED_DEFAULT);
+            fprintf(stderr, "         -ram <filename>   writes a dump of RAM when finished\n");
+            fprintf(stderr, "         -timing <filename> analyses the video timing after loading and writes the report\n");
+            fprintf(stderr, "         -wav <filename>   records the audio after loading as a 16 bit mono .wav\n");
+            fprintf(stderr, "         -rate <rate>      .wav sample rate, resampled band limited, (default 0 is the native scanline rate)\n");
+            fprintf(stderr, "         -music <score>    plays a built in score from midi/music.h after loading, repeat to queue several\n");
+            fprintf(stderr, "         -loader           sends a .gt1 through the emulated Loader protocol, a packet per frame, instead\n");
+            fprintf(stderr, "                           of writing it to RAM, the upload's frames come before -frames or -cycles\n");
+            fprintf(stderr, "         -benchmark <cycles> runs the ROM from power on with the switch decoder, the opcode table and the\n");
+            fprintf(stderr, "                           translation cache, reports Mcycles/s for each and exits\n");
+            fprintf(stderr, "         -jobs <threads>   batch mode, every input file runs on a machine of its own, -frames or -cycles each,\n");
+            fprintf(stderr, "                           spread across a pool of threads, (0 is one per core), and is hashed separately,\n");
+            fprintf(stderr, "                           there is no framebuffer hash and -loader, -ram, -timing, -wav and -music are refused\n");
+            fprintf(stderr, "         -lockstep <kernel> batch mode runs up to 32 machines at a time in lockstep, 0 scalar, 1 SSE2, 2 AVX2,\n");
+            fprintf(stderr, "                           batches that diverge fall back to the pool\n");
+            fprintf(stderr, "         -input <seed>     batch mode gives every machine its own pseudo random button, (or none), every frame\n");
+            fprintf(stderr, "         <input filename>  .gt1, .gasm, .vasm or .gbas, loaded once booted\n");
+            fprintf(stderr, "Example: gtemu-headless -frames 3600 -ram starfield.ram starfield.gt1\n");
+            return 1;
+        }
+    }
+
+    // Only batch mode takes more than one file, its machines have no display, audio, analyser or Loader and only their RAM is hashed
+    if(jobs < 0  &&  filenames.size() > 1)
+    {
+        fprintf(stderr, "gtemu-headless : more than one input filename needs -jobs\n");
+        return 1;
+    }
+    if(jobs < 0  &&  (lockstepKernel >= 0  ||  inputSeed))
+    {
+        fprintf(stderr, "gtemu-headless : -lockstep and -input need -jobs\n");
+        return 1;
+    }
+    if(saveFilename.size()  &&  runCycles > 0)
+    {
+        fprintf(stderr, "gtemu-headless : -save needs the run to end on a frame, use -frames rather than -cycles\n");
+        return 1;
+    }
+    if(jobs >= 0  &&  filenames.empty())
+    {
+        fprintf(stderr, "gtemu-headless : -jobs needs one or more input filenames\n");
+        return 1;
+    }
+    if(jobs >= 0  &&  (useLoader  ||  ramFilename.size()  ||  timingFilename.size()  ||  wavFilename.size()  ||  wavRate  ||  musicScores.size()  ||  saveFilename.size()))
+    {
+        fprintf(stderr, "gtemu-headless : -jobs can't be used with -loader, -ram, -timing, -wav, -rate, -music or -save\n");
+        return 1;
+    }
+
+    Cpu::State& S = Cpu::getMainMachine()._state;
+
+    Cpu::initialise(S);
+    Vcpu::initialise();
+    Memory::intitialise();
+    Expression::initialise();
+    Assembler::initialise();
+    Compiler::initialise();
+
+    if(romFilename.size()  &&  !loadRom(romFilename)) return 1;
+
+    // Power on contents are random, reseed and redo them so that every run of the same inputs is identical
+    srand(seed);
+    Cpu::initialise(Cpu::getMainMachine());
+
+    // Snapshots store RAM and ROM as deltas against the power on ROM, (or -rom), and an empty RAM, the same as the emulator
+    Snapshot::initialise();
+
+    Vcpu::setMode(vcpuMode);
+    Cpu::setBurstMode(burstMode != 0);
+
+    if(benchmarkCycles > 0)
+    {
+        Cpu::benchmark(benchmarkCycles);
+        return 0;
+    }
+
+    if(filenames.size()) filename = filenames[0];
+
+    auto start = std::chrono::steady_clock::now();
+
+    int framesDone = 0;
+    int64_t cycles = 0;
+    if(snapshotFilename.size())
+    {
+        if(!loadSnapshot(snapshotFilename, S)) return 1;
+    }
+    else
+    {
+        cycles = emulate(S, bootFrames, INT64_MAX, framesDone);
+    }
+    int frames = framesDone;
+
+    if(jobs >= 0) return runBatch(filenames, jobs, lockstepKernel, inputSeed, (runCycles > 0) ? runCycles : int64_t(runFrames)*SCAN_LINES*HLINE_END);
+
+    if(filename.size())
+    {
+        uint16_t executeAddress;
+        if(!loadFile(filename, useLoader, executeAddress)) return 1;
+
+        if(Loader::getUploading())
+        {
+            // Loader executes it once the last frame has been sent
+            while(Loader::getUploading())
+            {
+                cycles += emulate(S, 1, INT64_MAX, framesDone);
+                frames += framesDone;
+            }
+
+            const Loader::UploadReport& report = Loader::getUploadReport();
+            printf("loader %d bytes : %d packets : %d frames : %.3f seconds : %.1f bytes/s : %d bytes dropped\n", report._bytes, report._packets, report._frames, report._seconds,
+                                                                                                                 (report._seconds > 0.0) ? double(report._bytes) / report._seconds : 0.0, report._mismatches);
+            if(report._mismatches) return 3;
+        }
+        else
+        {
+            setExecuteAddress(executeAddress);
+        }
+    }
+
+    // Analysis runs a cycle at a time, so the throughput it reports is the analyser's
+    if(timingFilename.size()) Analyser::start();
+    _recording = !wavFilename.empty();
+
+    for(int i=0; i<int(musicScores.size()); i++)
+    {
+        if(!Audio::queueBuiltinScore(musicScores[i])) return 1;
+    }
+    if(musicScores.size()) Audio::setMusicPlaying(true);
+
+    cycles += (runCycles > 0) ? emulate(S, INT32_MAX, runCycles, framesDone) : emulate(S, runFrames, INT64_MAX, framesDone);
+    frames += framesDone;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mcps = (seconds > 0.0) ? double(cycles) / seconds / 1.0e6 : 0.0;
+
+    printf("%s : frames %d : cycles %" PRId64 " : %.3f seconds : %.2f Mcycles/s : %.1fx real time\n", GTEMU_HEADLESS_VERSION_STR, frames, cycles, seconds, mcps, mcps * 1.0e6 / CLOCK_FREQ);
+    printf("framebuffer %016" PRIx64 " : ram %016" PRIx64 " : PC %04x : AC %02x : X %02x : Y %02x : OUT %02x\n", hash(&_frameCompleted[0][0], sizeof _frameCompleted), hash(Cpu::getPtrToRAM(), RAM_SIZE), S._PC, S._AC, S._X, S._Y, S._OUT);
+
+    if(ramFilename.size()  &&  !saveRam(ramFilename)) return 1;
+
+    if(saveFilename.size()  &&  !saveSnapshot(saveFilename, S)) return 1;
+
+    if(wavFilename.size()  &&  !saveWav(wavFilename, wavRate)) return 1;
+
+    if(timingFilename.size())
+    {
+        Analyser::stop(timingFilename);
+        if(Analyser::getLinesInError()) return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "cpu.h"
+#include "vcpu.h"
+
+
+#define MAX_WRITES 16
+
+
+namespace Vcpu
+{
+    typedef void (*Instruction)(uint8_t operand);
+
+    // _ticks is the ROM's own tick charge for the instruction, (the immediate loaded before bra NEXT), every tick is two native cycles;
+    // _reenter is set for instructions that return through REENTER, which reloads Y from vPC
+    struct Opcode
+    {
+        Instruction _instruction;
+        uint8_t _ticks;
+        bool _reenter;
+    };
+
+    struct Write
+    {
+        uint16_t _address;
+        uint8_t _data;
+    };
+
+    int _mode = VCPU_MODE_OFF;
+    bool _romChecked = false;
+    bool _romValid = false;
+
+    // The st [y,x++] in front of ROM_VCPU_DISPATCH, read once by checkRom()
+    uint8_t _dispatchIR = 0x00, _dispatchD = 0x00;
+
+    Opcode _opcodes[256];
+
+    // The machine being executed and the code address of its current instruction, per thread so that every Cpu::Machine can use the fast path
+    thread_local uint8_t* _ram = NULL;
+    thread_local uint8_t* _dirtyPages = NULL;
+    thread_local uint16_t _code = 0x0000;
+
+    // Undo log, a time slice can run out part way through an instruction's effects as seen by NEXT, (e.g. ST $15)
+    thread_local int _numWrites = 0;
+    thread_local Write _writes[MAX_WRITES];
+
+
+    int getMode(void) {return _mode;}
+
+
+    uint8_t peek(uint16_t address) {return _ram[address & (RAM_SIZE-1)];}
+    void poke(uint16_t address, uint8_t data)
+    {
+        Write write = {uint16_t(address & (RAM_SIZE-1)), _ram[address & (RAM_SIZE-1)]};
+        _writes[_numWrites++] = write;
+        _ram[address & (RAM_SIZE-1)] = data;
+        _dirtyPages[(address & (RAM_SIZE-1)) >> 8] = DIRTY_PAGE_ALL;
+    }
+
+    // Code bytes following the opcode, within vPC's page
+    uint8_t code(int offset) {return _ram[((_code & 0xFF00) | uint8_t(_code + offset)) & (RAM_SIZE-1)];}
+
+    uint8_t carry(uint8_t sum, uint8_t a, uint8_t b) {return (sum & 0x80) ? (a & b) : (a | b);}
+
+
+    // Each instruction follows the ROM's own order of reads and writes, so that operands that alias the vCPU registers behave identically
+    void LDWI(uint8_t operand)  {poke(VCPU_AC, operand); poke(VCPU_AC+1, code(2)); poke(VCPU_PC, peek(VCPU_PC) + 1);}
+    void LD(uint8_t operand)    {poke(VCPU_AC, peek(operand)); poke(VCPU_AC+1, 0x00);}
+    void LDW(uint8_t operand)   {poke(VCPU_TMP, operand + 1); poke(VCPU_AC, peek(operand)); poke(VCPU_AC+1, peek(peek(VCPU_TMP)));}
+    void STW(uint8_t operand)   {poke(VCPU_TMP, operand + 1); poke(operand, peek(VCPU_AC)); poke(peek(VCPU_TMP), peek(VCPU_AC+1));}
+    void LDI(uint8_t operand)   {poke(VCPU_AC, operand); poke(VCPU_AC+1, 0x00);}
+    void ST(uint8_t operand)    {poke(operand, peek(VCPU_AC));}
+    void ANDI(uint8_t operand)  {poke(VCPU_AC, operand & peek(VCPU_AC)); poke(VCPU_AC+1, 0x00);}
+    void ORI(uint8_t operand)   {poke(VCPU_AC, operand | peek(VCPU_AC));}
+    void XORI(uint8_t operand)  {poke(VCPU_AC, operand ^ peek(VCPU_AC));}
+    void BRA(uint8_t operand)   {poke(VCPU_PC, operand);}
+    void INC(uint8_t operand)   {poke(operand, peek(operand) + 1);}
+    void ALLOC(uint8_t operand) {poke(VCPU_SP, operand + peek(VCPU_SP));}
+    void RET(uint8_t)           {poke(VCPU_PC, peek(VCPU_LR) - 2); poke(VCPU_PC+1, peek(VCPU_LR+1));}
+
+    bool isCondition(uint8_t operand)
+    {
+        return (operand == 0x3F  ||  operand == 0x4D  ||  operand == 0x50  ||  operand == 0x53  ||  operand == 0x56  ||  operand == 0x72);
+    }
+
+    void BCC(uint8_t operand)
+    {
+        poke(VCPU_TMP, peek(VCPU_AC+1));
+        if(peek(VCPU_AC+1) == 0x00  &&  peek(VCPU_AC) != 0x00) poke(VCPU_TMP, 0x01);
+
+        int8_t value = int8_t(peek(VCPU_TMP));
+        bool condition = false;
+        switch(operand)
+        {
+            case 0x3F: condition = (value == 0); break; // EQ
+            case 0x4D: condition = (value >  0); break; // GT
+            case 0x50: condition = (value <  0); break; // LT
+            case 0x53: condition = (value >= 0); break; // GE
+            case 0x56: condition = (value <= 0); break; // LE
+            case 0x72: condition = (value != 0); break; // NE
+        }
+
+        if(condition) poke(VCPU_PC, code(2)); else poke(VCPU_PC, peek(VCPU_PC) + 1);
+    }
+
+    void POP(uint8_t)
+    {
+        poke(VCPU_LR, peek(peek(VCPU_SP)));
+        poke(VCPU_LR+1, peek(uint8_t(peek(VCPU_SP) + 1)));
+        poke(VCPU_SP, peek(VCPU_SP) + 2);
+        poke(VCPU_PC, peek(VCPU_PC) - 1);
+    }
+
+    void PUSH(uint8_t)
+    {
+        poke(uint8_t(peek(VCPU_SP) - 1), peek(VCPU_LR+1));
+        uint8_t sp = peek(VCPU_SP) - 2;
+        poke(VCPU_SP, sp);
+        poke(sp, peek(VCPU_LR));
+        poke(VCPU_PC, peek(VCPU_PC) - 1);
+    }
+
+    void ADDW(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand + 1);
+        uint8_t sum = peek(VCPU_AC) + peek(operand);
+        poke(VCPU_AC, sum);
+        uint8_t x = carry(sum, sum - peek(operand), peek(operand)) & 0x80;
+        poke(VCPU_AC+1, peek(x) + peek(VCPU_AC+1) + peek(peek(VCPU_TMP)));
+    }
+
+    void SUBW(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand + 1);
+        uint8_t lo = peek(VCPU_AC);
+        uint8_t diff = lo - peek(operand);
+        poke(VCPU_AC, diff);
+        uint8_t x = carry(lo, diff, peek(operand)) & 0x80;
+        uint8_t hi = peek(VCPU_AC+1) - peek(x);
+        poke(VCPU_AC+1, hi - peek(peek(VCPU_TMP)));
+    }
+
+    void PEEK(uint8_t)
+    {
+        poke(VCPU_PC, peek(VCPU_PC) - 1);
+        poke(VCPU_AC, peek((peek(VCPU_AC+1) << 8) | peek(VCPU_AC)));
+        poke(VCPU_AC+1, 0x00);
+    }
+
+    void DEF(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        poke(VCPU_AC, peek(VCPU_PC) + 2);
+        poke(VCPU_AC+1, peek(VCPU_PC+1));
+        poke(VCPU_PC, peek(VCPU_TMP));
+    }
+
+    void CALL(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        poke(VCPU_LR, peek(VCPU_PC) + 2);
+        poke(VCPU_LR+1, peek(VCPU_PC+1));
+        poke(VCPU_PC, peek(peek(VCPU_TMP)) - 2);
+        poke(VCPU_PC+1, peek(uint8_t(peek(VCPU_TMP) + 1)));
+    }
+
+    void ADDI(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        uint8_t sum = operand + peek(VCPU_AC);
+        poke(VCPU_AC, sum);
+        uint8_t x = carry(sum, sum - peek(VCPU_TMP), peek(VCPU_TMP)) & 0x80;
+        poke(VCPU_AC+1, peek(x) + peek(VCPU_AC+1));
+    }
+
+    void SUBI(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        uint8_t lo = peek(VCPU_AC);
+        uint8_t diff = lo - peek(VCPU_TMP);
+        poke(VCPU_AC, diff);
+        uint8_t x = carry(lo, diff, peek(VCPU_TMP)) & 0x80;
+        poke(VCPU_AC+1, peek(VCPU_AC+1) - peek(x));
+    }
+
+    void LSLW(uint8_t)
+    {
+        uint8_t lo = peek(VCPU_AC);
+        poke(VCPU_AC, lo + lo);
+        poke(VCPU_AC+1, peek(lo & 0x80) + peek(VCPU_AC+1) + peek(VCPU_AC+1));
+        poke(VCPU_PC, peek(VCPU_PC) - 1);
+    }
+
+    void STLW(uint8_t operand)
+    {
+        uint8_t address = operand + peek(VCPU_SP);
+        poke(VCPU_TMP, address);
+        poke(uint8_t(address + 1), peek(VCPU_AC+1));
+        poke(peek(VCPU_TMP), peek(VCPU_AC));
+    }
+
+    void LDLW(uint8_t operand)
+    {
+        uint8_t address = operand + peek(VCPU_SP);
+        poke(VCPU_TMP, address);
+        poke(VCPU_AC+1, peek(uint8_t(address + 1)));
+        poke(VCPU_AC, peek(peek(VCPU_TMP)));
+    }
+
+    void POKE(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        uint8_t hi = peek(uint8_t(operand + 1));
+        uint8_t lo = peek(peek(VCPU_TMP));
+        poke((hi << 8) | lo, peek(VCPU_AC));
+    }
+
+    void DOKE(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        uint8_t hi = peek(uint8_t(operand + 1));
+        uint8_t lo = peek(peek(VCPU_TMP));
+        poke((hi << 8) | lo, peek(VCPU_AC));
+        poke((hi << 8) | uint8_t(lo + 1), peek(VCPU_AC+1));
+    }
+
+    void DEEK(uint8_t)
+    {
+        poke(VCPU_PC, peek(VCPU_PC) - 1);
+        uint8_t lo = peek(VCPU_AC);
+        uint8_t hi = peek(VCPU_AC+1);
+        poke(VCPU_AC, peek((hi << 8) | lo));
+        poke(VCPU_AC+1, peek((hi << 8) | uint8_t(lo + 1)));
+    }
+
+    void ANDW(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        poke(VCPU_AC+1, peek(uint8_t(operand + 1)) & peek(VCPU_AC+1));
+        poke(VCPU_AC, peek(peek(VCPU_TMP)) & peek(VCPU_AC));
+        poke(VCPU_TMP, 0xF2); // jmp y,$cb delay slot is orw's st [$1d]
+    }
+
+    void ORW(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        poke(VCPU_AC+1, peek(uint8_t(operand + 1)) | peek(VCPU_AC+1));
+        poke(VCPU_AC, peek(peek(VCPU_TMP)) | peek(VCPU_AC));
+    }
+
+    void XORW(uint8_t operand)
+    {
+        poke(VCPU_TMP, operand);
+        poke(VCPU_AC+1, peek(uint8_t(operand + 1)) ^ peek(VCPU_AC+1));
+        poke(VCPU_AC, peek(peek(VCPU_TMP)) ^ peek(VCPU_AC));
+    }
+
+
+    void setOpcode(uint8_t opcode, Instruction instruction, uint8_t ticks, bool reenter)
+    {
+        _opcodes[opcode]._instruction = instruction;
+        _opcodes[opcode]._ticks = ticks;
+        _opcodes[opcode]._reenter = reenter;
+    }
+
+    void setMode(int mode)
+    {
+        _mode = mode;
+    }
+
+    // SYS and LUP jump to code outside of the interpreter, (and anything else is garbage), so they are left to native emulation
+    void initialise(void)
+    {
+        for(int i=0; i<256; i++) setOpcode(uint8_t(i), NULL, 0x00, false);
+
+        setOpcode(0x11, LDWI,  0xF6, false);
+        setOpcode(0x1A, LD,    0xF7, false);
+        setOpcode(0x21, LDW,   0xF6, false);
+        setOpcode(0x2B, STW,   0xF6, false);
+        setOpcode(0x35, BCC,   0xF2, false);
+        setOpcode(0x59, LDI,   0xF8, false);
+        setOpcode(0x5E, ST,    0xF8, false);
+        setOpcode(0x63, POP,   0xF3, false);
+        setOpcode(0x75, PUSH,  0xF3, false);
+        setOpcode(0x82, ANDI,  0xF8, false);
+        setOpcode(0x88, ORI,   0xF9, false);
+        setOpcode(0x8C, XORI,  0xF9, false);
+        setOpcode(0x90, BRA,   0xF9, false);
+        setOpcode(0x93, INC,   0xF8, false);
+        setOpcode(0x99, ADDW,  0xF2, false);
+        setOpcode(0xAD, PEEK,  0xF3, true );
+        setOpcode(0xB8, SUBW,  0xF2, true );
+        setOpcode(0xCD, DEF,   0xF3, true );
+        setOpcode(0xCF, CALL,  0xF3, true );
+        setOpcode(0xDF, ALLOC, 0xF9, false);
+        setOpcode(0xE3, ADDI,  0xF2, true );
+        setOpcode(0xE6, SUBI,  0xF2, true );
+        setOpcode(0xE9, LSLW,  0xF2, true );
+        setOpcode(0xEC, STLW,  0xF3, true );
+        setOpcode(0xEE, LDLW,  0xF3, true );
+        setOpcode(0xF0, POKE,  0xF3, true );
+        setOpcode(0xF3, DOKE,  0xF2, true );
+        setOpcode(0xF6, DEEK,  0xF2, true );
+        setOpcode(0xF8, ANDW,  0xF2, true );
+        setOpcode(0xFA, ORW,   0xF2, true );
+        setOpcode(0xFC, XORW,  0xF3, true );
+        setOpcode(0xFF, RET,   0xF6, true );
+
+        _romChecked = false;
+        setMode(VCPU_MODE_DEFAULT);
+    }
+
+    void invalidatePage(uint16_t address)
+    {
+        uint16_t page = (address & (ROM_SIZE-1)) & 0xFF00;
+        if(page >= (VCPU_ROM_START & 0xFF00)  &&  page <= ((VCPU_ROM_END-1) & 0xFF00)) _romChecked = false;
+    }
+
+    void invalidatePages(void)
+    {
+        _romChecked = false;
+    }
+
+    // Cpu::translateRom() calls this before machines are run on other threads, after that the result is only ever read
+    bool checkRom(void)
+    {
+        uint32_t checksum = 2166136261u;
+        for(int i=VCPU_ROM_START; i<VCPU_ROM_END; i++)
+        {
+            checksum = (checksum ^ Cpu::getROM(uint16_t(i), ROM_INST)) * 16777619u;
+            checksum = (checksum ^ Cpu::getROM(uint16_t(i), ROM_DATA)) * 16777619u;
+        }
+
+        _dispatchIR = Cpu::getROM(ROM_VCPU_DISPATCH-1, ROM_INST);
+        _dispatchD = Cpu::getROM(ROM_VCPU_DISPATCH-1, ROM_DATA);
+
+        _romChecked = true;
+        _romValid = (checksum == VCPU_ROM_CHECKSUM);
+        if(!_romValid  &&  _mode != VCPU_MODE_OFF)
+        {
+            fprintf(stderr, "Vcpu::checkRom() : vCPU interpreter checksum 0x%08X doesn't match 0x%08X, using native emulation.\n", checksum, VCPU_ROM_CHECKSUM);
+        }
+
+        return _romValid;
+    }
+
+    void undo(void)
+    {
+        for(int i=_numWrites-1; i>=0; i--) _ram[_writes[i]._address] = _writes[i]._data;
+        _numWrites = 0;
+    }
+
+    // Interpreter store address for the instruction in S._IR
+    uint16_t storeAddress(const Cpu::State& S)
+    {
+        int mod = (S._IR >> 2) & 7;
+        uint8_t lo = (mod == 1  ||  mod == 3  ||  mod == 7) ? S._X : S._D;
+        uint8_t hi = (mod == 2  ||  mod == 3  ||  mod == 7) ? S._Y : 0;
+        return ((hi << 8) | lo) & (RAM_SIZE-1);
+    }
+
+    // Undoes the instruction's writes and replays it through Cpu::cycle(), on any difference the interpreter's results are kept
+    void selfCheck(const Cpu::State& S, Cpu::State& T, int cycles)
+    {
+        int numWrites = _numWrites;
+        uint8_t data[MAX_WRITES];
+        Write writes[MAX_WRITES];
+        for(int i=0; i<numWrites; i++)
+        {
+            writes[i] = _writes[i];
+            data[i] = _ram[_writes[i]._address];
+        }
+        undo();
+
+        bool error = false;
+        Cpu::State R = S;
+        for(int i=0; i<cycles; i++)
+        {
+            // Every native store that changes RAM must hit a location the fast path wrote
+            uint16_t address = storeAddress(R);
+            uint8_t before = _ram[address];
+            bool store = ((R._IR >> 5) == 6);
+            R = Cpu::cycle(R);
+            if(store  &&  _ram[address] != before)
+            {
+                bool found = false;
+                for(int j=0; j<numWrites; j++) found |= (writes[j]._address == address);
+                if(!found) error = true;
+            }
+        }
+
+        error |= (R._PC != T._PC  ||  R._IR != T._IR  ||  R._D != T._D  ||  R._AC != T._AC  ||  R._X != T._X  ||  R._Y != T._Y  ||  R._OUT != T._OUT);
+        for(int i=0; i<numWrites; i++) error |= (_ram[writes[i]._address] != data[i]);
+
+        if(error)
+        {
+            fprintf(stderr, "Vcpu::selfCheck() : opcode 0x%02x : vPC 0x%04x : %d cycles : PC %04x/%04x : AC %02x/%02x : X %02x/%02x : Y %02x/%02x\n",
+                            S._AC, (S._Y << 8) | S._X, cycles, T._PC, R._PC, T._AC, R._AC, T._X, R._X, T._Y, R._Y);
+        }
+
+        T = R;
+    }
+
+    int64_t execute(Cpu::Machine& M, Cpu::State& S, int64_t cycles)
+    {
+        if(_mode == VCPU_MODE_OFF  ||  S._PC != ROM_VCPU_DISPATCH) return 0;
+        if(!_romChecked) checkRom();
+        if(!_romValid) return 0;
+
+        _ram = M._RAM;
+        _dirtyPages = M._dirtyPages;
+        bool usage = (&M == &Cpu::getMainMachine());
+
+        int64_t executed = 0;
+        for(;;)
+        {
+            // Must be sitting in front of st [y,x++] with the opcode in AC, and not executing from zero page where code and registers alias
+            if(S._PC != ROM_VCPU_DISPATCH  ||  S._IR != _dispatchIR  ||  S._D != _dispatchD  ||  S._Y == 0x00) break;
+
+            const Opcode& opcode = _opcodes[S._AC];
+            int cost = 2 * (256 - opcode._ticks);
+            if(opcode._instruction == NULL  ||  cost > cycles - executed) break;
+
+            // BCC dispatches on its condition byte, anything other than a real condition lands somewhere random in page 3
+            _code = (S._Y << 8) | S._X;
+            if(opcode._instruction == BCC  &&  !isCondition(code(1))) break;
+
+            // st [y,x++], bra ac, ld [y,x]
+            _numWrites = 0;
+            poke(_code, S._AC);
+            opcode._instruction(code(1));
+
+            // NEXT, the last instruction of a time slice takes the native EXIT path
+            uint8_t ticks = opcode._ticks + peek(VCPU_TICKS);
+            if(ticks & 0x80)
+            {
+                undo();
+                break;
+            }
+            poke(VCPU_TICKS, ticks);
+            poke(VCPU_PC, peek(VCPU_PC) + 2);
+
+            Cpu::State T = S;
+            T._X = peek(VCPU_PC);
+            if(opcode._reenter) T._Y = peek(VCPU_PC+1);
+            T._AC = peek((T._Y << 8) | T._X);
+
+            if(_mode == VCPU_MODE_SELFCHECK) selfCheck(S, T, cost);
+
+            // main() only sees the dispatch state it started from, so usage is counted here for the rest
+            if(executed  &&  usage) Cpu::vCpuUsage(S);
+
+            S = T;
+            executed += cost;
+        }
+
+        return executed;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef VCPU_H
+#define VCPU_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+
+#define VCPU_MODE_OFF        0
+#define VCPU_MODE_ON         1
+#define VCPU_MODE_SELFCHECK  2
+
+// Default for the vCPU fast path, VCPU_MODE_SELFCHECK replays every vCPU instruction through Cpu::cycle() and reports any difference,
+// (gtemu-headless -vcpu 0/1 compares the fast path with the threaded interpreter)
+#define VCPU_MODE_DEFAULT  VCPU_MODE_ON
+
+// vCPU interpreter, (ENTER to xorw in ROMv1), the fast path is only used when the ROM's interpreter matches this checksum
+#define VCPU_ROM_START     0x02FF
+#define VCPU_ROM_END       0x04A7
+#define VCPU_ROM_CHECKSUM  0x8C82D635
+
+// vCPU registers in zero page
+#define VCPU_TICKS  0x0015
+#define VCPU_PC     0x0016
+#define VCPU_AC     0x0018
+#define VCPU_LR     0x001A
+#define VCPU_SP     0x001C
+#define VCPU_TMP    0x001D
+
+
+namespace Vcpu
+{
+    int getMode(void);
+
+    void setMode(int mode);
+
+    void initialise(void);
+    void invalidatePage(uint16_t address);
+    void invalidatePages(void);
+    bool checkRom(void);
+
+    // Only does anything when S is sitting on ROM_VCPU_DISPATCH; executes whole vCPU instructions on M, each charged its exact native cycle
+    // cost, until the time slice runs out, a SYS or LUP instruction is reached or the cycle budget is spent; returns the number of cycles
+    // executed, any number of machines can be executed at once on their own threads
+    int64_t execute(Cpu::Machine& M, Cpu::State& S, int64_t cycles);
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <math.h>
+#include <fstream>
+#include <algorithm>
+
+#include "wav.h"
+#include "codec.h"
+
+
+namespace Wav
+{
+    void putTag(std::vector<uint8_t>& buffer, const char* tag) {buffer.insert(buffer.end(), tag, tag + 4);}
+
+
+    bool writeFile(const std::string& filename, const std::vector<int16_t>& samples, int rate)
+    {
+        uint32_t dataSize = uint32_t(samples.size() * sizeof(int16_t));
+
+        std::vector<uint8_t> wav;
+        wav.reserve(44 + dataSize);
+        putTag(wav, "RIFF");
+        Codec::put32(wav, 36 + dataSize);
+        putTag(wav, "WAVE");
+        putTag(wav, "fmt ");
+        Codec::put32(wav, 16);
+        Codec::put16(wav, 1);
+        Codec::put16(wav, 1);
+        Codec::put32(wav, rate);
+        Codec::put32(wav, rate * uint32_t(sizeof(int16_t)));
+        Codec::put16(wav, uint16_t(sizeof(int16_t)));
+        Codec::put16(wav, 16);
+        putTag(wav, "data");
+        Codec::put32(wav, dataSize);
+        for(int i=0; i<int(samples.size()); i++) Codec::put16(wav, uint16_t(samples[i]));
+
+        std::ofstream outfile(filename, std::ios::binary | std::ios::out);
+        if(!outfile.is_open())
+        {
+            fprintf(stderr, "Wav::writeFile() : failed to open '%s'\n", filename.c_str());
+            return false;
+        }
+
+        outfile.write((const char*)&wav[0], wav.size());
+        if(outfile.bad()  ||  outfile.fail())
+        {
+            fprintf(stderr, "Wav::writeFile() : write error in '%s'\n", filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // Blackman windowed sinc, one set of taps per fractional position, each set normalised so that DC passes unchanged
+    void createFilter(double cutoff, std::vector<double>& filter)
+    {
+        const double pi = 3.14159265358979323846;
+        const int width = WAV_RESAMPLE_TAPS*2;
+
+        filter.resize((WAV_RESAMPLE_PHASES + 1) * width);
+        for(int p=0; p<=WAV_RESAMPLE_PHASES; p++)
+        {
+            double* taps = &filter[p * width];
+            double fraction = double(p) / double(WAV_RESAMPLE_PHASES);
+            double sum = 0.0;
+            for(int t=0; t<width; t++)
+            {
+                double x = double(t - WAV_RESAMPLE_TAPS + 1) - fraction;
+                double sinc = (x == 0.0) ? 1.0 : sin(pi * cutoff * x) / (pi * cutoff * x);
+                double w = (x + double(WAV_RESAMPLE_TAPS)) / double(width);
+                double window = 0.42 - 0.5*cos(2.0*pi*w) + 0.08*cos(4.0*pi*w);
+                taps[t] = sinc * window;
+                sum += taps[t];
+            }
+            for(int t=0; t<width; t++) taps[t] /= sum;
+        }
+    }
+
+    void resample(const std::vector<int16_t>& input, double inputRate, int outputRate, std::vector<int16_t>& output)
+    {
+        output.clear();
+        if(input.empty()  ||  inputRate <= 0.0  ||  outputRate <= 0) return;
+
+        // Cutoff relative to the input's Nyquist frequency
+        double ratio = double(outputRate) / inputRate;
+        std::vector<double> filter;
+        createFilter(std::min(1.0, ratio) * WAV_RESAMPLE_CUTOFF, filter);
+
+        // Input beyond either end is taken to hold the first and last samples
+        int inputSize = int(input.size());
+        size_t outputSize = size_t(double(inputSize) * ratio);
+        output.resize(outputSize);
+        for(size_t n=0; n<outputSize; n++)
+        {
+            double position = double(n) / ratio;
+            int index = int(position);
+            const double* taps = &filter[int((position - double(index)) * WAV_RESAMPLE_PHASES + 0.5) * WAV_RESAMPLE_TAPS*2];
+
+            double sum = 0.0;
+            for(int t=0; t<WAV_RESAMPLE_TAPS*2; t++)
+            {
+                int i = std::min(std::max(index + t - WAV_RESAMPLE_TAPS + 1, 0), inputSize - 1);
+                sum += taps[t] * double(input[i]);
+            }
+            output[n] = int16_t(std::min(std::max(lrint(sum), -32768L), 32767L));
+        }
+    }
+}
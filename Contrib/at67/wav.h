@@ -0,0 +1,27 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// Windowed sinc, taps either side of each output sample and the number of fractional positions between input samples
+#define WAV_RESAMPLE_TAPS    16
+#define WAV_RESAMPLE_PHASES  512
+
+// Fraction of the lower Nyquist frequency that is passed, the rest is the filter's transition band
+#define WAV_RESAMPLE_CUTOFF  0.9
+
+
+namespace Wav
+{
+    // 16 bit mono PCM
+    bool writeFile(const std::string& filename, const std::vector<int16_t>& samples, int rate);
+
+    // Band limited from any rate to any other, the cutoff is below the lower of the two Nyquist frequencies so that neither images
+    // of the Gigatron's 31.25kHz steps nor anything above the output's Nyquist frequency make it through
+    void resample(const std::vector<int16_t>& input, double inputRate, int outputRate, std::vector<int16_t>& output);
+}
+
+#endif